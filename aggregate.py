@@ -0,0 +1,81 @@
+"""
+Streaming per-window aggregation of monitoring samples for the forwarder.
+
+WindowAggregator turns a stream of timestamped samples into one record per
+fixed window (aligned to multiples of window_ms) with the min, max and mean of
+every key, so a short spike survives as the window's max while the upload
+volume drops to one record per window. Keys listed in `integrate` also get
+their time integral over the window (trapezoidal, e.g. power in W -> energy in J).
+
+Keys look like "<quantity>-<suffix>" (e.g. "power-m3_1"); the aggregates are
+named "<quantity>_min-<suffix>", "<quantity>_max-<suffix>", ... and the integral
+"<integral name>-<suffix>".
+"""
+
+
+class WindowAggregator:
+
+    def __init__(self, window_ms, integrate=None):
+        """
+        :param window_ms: window length in milliseconds
+        :param integrate: {quantity: integral name}, e.g. {"power": "energy"}
+        """
+        self.window_ms = window_ms
+        self.integrate = integrate or {}
+        self.window = None
+        # key -> [min, max, sum, count]
+        self.stats = {}
+        # key -> integral over the current window, and the last sample (ts, value) per key
+        self.integrals = {}
+        self.last = {}
+
+    def add(self, ts, values):
+        """
+        Adds one sample.
+        :param ts: timestamp in ms
+        :param values: {key: number or numeric string}
+        :return: list of records {"ts": window start, "values": {..}} of the windows it closed
+        """
+        closed = []
+        start = ts - ts % self.window_ms
+        if self.window is not None and start != self.window:
+            closed.append(self.flush())
+        self.window = start
+
+        for key, value in values.items():
+            value = float(value)
+            stats = self.stats.get(key)
+            if stats is None:
+                self.stats[key] = [value, value, value, 1]
+            else:
+                stats[0] = min(stats[0], value)
+                stats[1] = max(stats[1], value)
+                stats[2] += value
+                stats[3] += 1
+
+            if key.partition("-")[0] in self.integrate:
+                # the interval since the previous sample counts for the window of this one
+                if key in self.last and ts > self.last[key][0]:
+                    last_ts, last_value = self.last[key]
+                    self.integrals[key] = (self.integrals.get(key, 0.0)
+                                           + (last_value + value) / 2 * (ts - last_ts) / 1000)
+                self.last[key] = (ts, value)
+        return closed
+
+    def flush(self):
+        """Closes the current window, returns its record (None if it is empty)."""
+        if self.window is None or not self.stats:
+            return None
+        values = {}
+        for key, (low, high, total, count) in self.stats.items():
+            quantity, sep, suffix = key.partition("-")
+            values[f"{quantity}_min{sep}{suffix}"] = low
+            values[f"{quantity}_max{sep}{suffix}"] = high
+            values[f"{quantity}_mean{sep}{suffix}"] = round(total / count, 6)
+            if quantity in self.integrate:
+                values[f"{self.integrate[quantity]}{sep}{suffix}"] = round(self.integrals.get(key, 0.0), 9)
+        record = {"ts": self.window, "values": values}
+        self.stats = {}
+        self.integrals = {}
+        self.window = None
+        return record
@@ -0,0 +1,190 @@
+"""
+Gateway-side cache of CoAP responses, keyed by node and resource path.
+
+Entries are fresh for the response's Max-Age; a stale entry with an ETag is
+revalidated, so an unchanged value costs the node a 2.03 without payload.
+Concurrent reads of the same resource share one request. Local consumers read
+through the cache over HTTP (see serve_http), so they never reach the mote while
+a value is fresh.
+"""
+import asyncio
+import collections
+import json
+import logging
+import time
+
+import aiocoap
+import aiocoap.optiontypes
+
+
+# Max-Age when the response has none (RFC 7252, section 5.10.5)
+DEFAULT_MAX_AGE = 60
+# Content-Format of timestamped samples, see tracing.py
+JSON_FORMAT = 50
+# HTTP Content-Type of the formats served as they are
+CONTENT_TYPES = {JSON_FORMAT: "application/json", 110: "application/senml+json", 112: "application/senml+cbor"}
+
+
+class CacheEntry:
+    def __init__(self, payload, etag, content_format, max_age):
+        self.payload = payload
+        self.etag = etag
+        self.content_format = content_format
+        # when the gateway received the payload, kept across revalidations
+        self.received_ms = int(time.time() * 1000)
+        self.refresh(max_age)
+
+    def refresh(self, max_age):
+        self.expires = time.monotonic() + max_age
+
+    def max_age(self):
+        """Seconds the entry stays fresh, 0 once stale."""
+        return max(0, int(self.expires - time.monotonic()))
+
+    def is_fresh(self):
+        return time.monotonic() < self.expires
+
+
+class ResponseCache:
+    def __init__(self, fetch, max_entries=4096, accept=None):
+        """
+        :param fetch: coroutine function (node, request) -> response, which
+            applies the gateway's per-node and global request limits
+        :param max_entries: least recently used entries are dropped past this
+        :param accept: Content-Format requested from the nodes, e.g. JSON_FORMAT
+        """
+        self.fetch = fetch
+        self.max_entries = max_entries
+        self.accept = accept
+        self.entries = collections.OrderedDict()
+        self.pending = {}
+        self.hits = 0
+        self.misses = 0
+        self.revalidations = 0
+
+    def store(self, node, path, response):
+        """
+        Caches a response, also used for observe notifications.
+        :return: the entry, None if the response is not cacheable
+        """
+        key = (node, path)
+        max_age = response.opt.max_age
+        if max_age is None:
+            max_age = DEFAULT_MAX_AGE
+
+        if response.code == aiocoap.VALID and key in self.entries:
+            entry = self.entries[key]
+            entry.refresh(max_age)
+        elif response.code == aiocoap.CONTENT:
+            entry = CacheEntry(response.payload, response.opt.etag, response.opt.content_format, max_age)
+            self.entries[key] = entry
+        else:
+            return None
+
+        self.entries.move_to_end(key)
+        while len(self.entries) > self.max_entries:
+            self.entries.popitem(last=False)
+        return entry
+
+    async def get(self, node, path, accept=None, block_szx=None):
+        """
+        Returns a fresh entry for the resource, asking the node only when needed.
+        Raises if the node does not answer with 2.05 or 2.03.
+        :param accept: Content-Format requested instead of the cache's; a fresh entry is
+            returned in whatever format it was fetched, see entry.content_format
+        :param block_szx: Block2 size exponent, blocks of 2 ** (4 + block_szx) bytes
+        """
+        key = (node, path)
+        entry = self.entries.get(key)
+        if entry is not None and entry.is_fresh():
+            self.hits += 1
+            return entry
+
+        if key not in self.pending:
+            self.misses += 1
+            self.pending[key] = asyncio.ensure_future(self._fetch(node, path, entry, accept, block_szx))
+            self.pending[key].add_done_callback(lambda _: self.pending.pop(key, None))
+        return await asyncio.shield(self.pending[key])
+
+    async def _fetch(self, node, path, stale, accept, block_szx):
+        request = aiocoap.Message(code=aiocoap.GET, uri=f'coap://[{node}]/{path}')
+        accept = accept if accept is not None else self.accept
+        if accept is not None:
+            request.opt.accept = accept
+        if block_szx is not None:
+            # aiocoap fetches the later blocks with the same size
+            request.opt.block2 = aiocoap.optiontypes.BlockOption.BlockwiseTuple(0, False, block_szx)
+        if stale is not None and stale.etag is not None:
+            request.opt.etags = [stale.etag]
+            self.revalidations += 1
+
+        response = await self.fetch(node, request)
+        entry = self.store(node, path, response)
+        if entry is None:
+            raise RuntimeError(f"{path} on {node}: {response.code}")
+        return entry
+
+
+# HTTP ========================================================================
+
+
+async def handle_http(cache, reader, writer):
+    """
+    GET /<node>/<path>, e.g. /2001:660:5307:3144::1662/s/t
+    Answers with the cached payload, Cache-Control and ETag; If-None-Match gets a 304.
+    Timestamped samples are unwrapped to the bare value unless application/json is accepted.
+    """
+    try:
+        request_line = (await reader.readline()).decode(errors="replace").split()
+        headers = {}
+        while True:
+            line = (await reader.readline()).decode(errors="replace").strip()
+            if not line:
+                break
+            name, _, value = line.partition(":")
+            headers[name.strip().lower()] = value.strip()
+
+        if len(request_line) < 2 or request_line[0] != "GET":
+            status, extra, body = "405 Method Not Allowed", {}, b""
+        else:
+            node, _, path = request_line[1].lstrip("/").partition("/")
+            node = node.strip("[]")
+            if not node or not path:
+                status, extra, body = "404 Not Found", {}, b""
+            else:
+                try:
+                    entry = await cache.get(node, path)
+                except Exception as e:
+                    logging.warning(f"[cache] {node}/{path}: {e}")
+                    status, extra, body = "502 Bad Gateway", {}, str(e).encode()
+                else:
+                    extra = {"Cache-Control": f"max-age={entry.max_age()}"}
+                    if entry.etag is not None:
+                        extra["ETag"] = f'"{entry.etag.hex()}"'
+                    if entry.etag is not None and headers.get("if-none-match") == extra["ETag"]:
+                        status, body = "304 Not Modified", b""
+                    else:
+                        status, body = "200 OK", entry.payload
+                        if entry.content_format == JSON_FORMAT and "application/json" not in headers.get("accept", ""):
+                            body = str(json.loads(body)["v"]).encode()
+                        elif entry.content_format in CONTENT_TYPES:
+                            extra["Content-Type"] = CONTENT_TYPES[entry.content_format]
+
+        writer.write(f"HTTP/1.1 {status}\r\n".encode())
+        for name, value in {"Content-Type": "text/plain", "Content-Length": len(body),
+                            "Connection": "close", **extra}.items():
+            writer.write(f"{name}: {value}\r\n".encode())
+        writer.write(b"\r\n" + body)
+        await writer.drain()
+    except (ConnectionError, asyncio.IncompleteReadError):
+        pass
+    finally:
+        writer.close()
+
+
+async def serve_http(cache, host, port):
+    """Serves the cache to local consumers until cancelled."""
+    server = await asyncio.start_server(lambda r, w: handle_http(cache, r, w), host, port)
+    logging.info(f"[cache] serving on http://{host}:{port}/<node>/<path>")
+    async with server:
+        await server.serve_forever()
@@ -1,181 +1,467 @@
 import asyncio
 import aiocoap
+import aiocoap.error
+import contextlib
+import functools
 import logging
-import requests
+import os
+import time
+
+import metrics
+import senml
+from cache import JSON_FORMAT, ResponseCache, serve_http
+from discovery import fetch_routes, parse_link_format
+from scheduler import PollScheduler
+from thingsboard import BatchUploader
+from timesync import TimeSync
+from tracing import Sample, SequenceTracker, parse_sample
 
 
 logging.basicConfig(level=logging.INFO)
 
 # CONFIG ======================================================================
 
-RESOURCE_SERVER = '2001:660:5307:3144::1662'
+# Nodes are discovered from the border router's route list when BORDER_ROUTER is
+# set; otherwise only RESOURCE_SERVER is polled, as before.
+BORDER_ROUTER = os.environ.get("BORDER_ROUTER")
+RESOURCE_SERVER = os.environ.get("SENSOR_SERVER", '2001:660:5307:3144::1662')
+# Seconds between two fetches of the route list
+DISCOVERY_PERIOD = 30
+# Seconds before retrying .well-known/core on a node that did not answer
+DISCOVERY_RETRY = 60
 DEVICE_TOKEN = "MONITOKEN"
-THINGSBOARD_HEADERS = {'Content-Type': 'application/json'}
+# Samples wait here until ThingsBoard acknowledged them
+SPOOL_DIR = os.path.expanduser("~/.gin206/spool/client")
+
+# Poll periods, rate limits and jitter, re-read when the file changes
+SCHEDULE_CONFIG = os.environ.get("SCHEDULE_CONFIG",
+                                 os.path.join(os.path.dirname(os.path.abspath(__file__)), "schedule.json"))
+
+# Outstanding requests per node (CoAP NSTART, RFC 7252 section 4.7)
+NSTART = 1
+# Outstanding requests towards all nodes together, bounds the gateway's load
+MAX_CONCURRENT_REQUESTS = 64
+
+# Local consumers read cached values at http://CACHE_HOST:CACHE_PORT/<node>/<path>
+CACHE_HOST = "127.0.0.1"
+CACHE_PORT = int(os.environ.get("CACHE_PORT", 8086))
+
+# Prometheus scrapes http://METRICS_HOST:METRICS_PORT/metrics
+METRICS_HOST = "127.0.0.1"
+METRICS_PORT = int(os.environ.get("METRICS_PORT", 9106))
+
+
+# METRICS =====================================================================
+
+
+COAP_RTT = metrics.histogram("gateway_coap_rtt_seconds",
+                             "CoAP request to response time, retransmissions included", ("node", "resource"))
+COAP_WAIT = metrics.histogram("gateway_coap_wait_seconds",
+                              "Wait for a free request slot (NSTART and global limit)", ("node",))
+COAP_TIMEOUTS = metrics.counter("gateway_coap_timeouts_total",
+                                "Requests without response after all retransmissions", ("node", "resource"))
+COAP_ERRORS = metrics.counter("gateway_coap_errors_total", "Requests failed otherwise", ("node", "resource"))
+COAP_RETRANSMISSIONS = metrics.counter("gateway_coap_retransmissions_total", "CON retransmissions sent")
+COAP_NOTIFICATIONS = metrics.counter("gateway_coap_notifications_total",
+                                     "Observe notifications received", ("node", "resource"))
+
+
+class RetransmissionCounter(logging.Handler):
+    """aiocoap does not count its retransmissions, but logs each of them."""
+
+    def emit(self, record):
+        if record.getMessage().startswith("Retransmission"):
+            COAP_RETRANSMISSIONS.inc()
+
+
+def register_gauges():
+    """Exposes the state of the upload, poll and cache stages, read at every scrape."""
+    metrics.gauge("gateway_spool_bytes", "Bytes spooled and not yet acknowledged by ThingsBoard",
+                  callback=lambda: {(): uploader.pending_bytes()})
+    metrics.gauge("gateway_spool_fill_ratio", "Spool size relative to its limit",
+                  callback=lambda: {(): uploader.fill_ratio()})
+    metrics.gauge("gateway_upload_queue_samples", "Samples spooled since the last upload started",
+                  callback=lambda: {(): uploader.queued})
+    metrics.gauge("gateway_backpressure_factor", "Factor poll periods are stretched by",
+                  callback=lambda: {(): uploader.backpressure()})
+    metrics.gauge("gateway_schedules", "Scheduled (node, resource) polls",
+                  callback=lambda: {(): len(scheduler.schedules)})
+    metrics.counter("gateway_scheduler_polls_total", "Polls started by the scheduler",
+                    callback=lambda: {(): scheduler.polls})
+    metrics.counter("gateway_scheduler_deferred_total", "Tick-long deferrals by the rate limits",
+                    callback=lambda: {(): scheduler.deferred})
+    metrics.counter("gateway_scheduler_skipped_total", "Polls skipped as the previous one was still running",
+                    callback=lambda: {(): scheduler.skipped})
+    metrics.counter("gateway_cache_requests_total", "Reads through the response cache", ("result",),
+                    callback=lambda: {("hit",): cache.hits, ("miss",): cache.misses})
+    metrics.counter("gateway_cache_revalidations_total", "Misses sent with the ETag of a stale entry",
+                    callback=lambda: {(): cache.revalidations})
+
+
+def forget_node(node):
+    for metric in metrics.REGISTRY:
+        metric.forget("node", node)
 
 
 # AUX FUNCTIONS ===============================================================
 
 
-def get_thingsboard_uri(device):
-    return f"http://mauro.rezel.net:8080/api/v1/{device}/telemetry"
+def get_uri(node, resource):
+    return f'coap://[{node}]/{resource}'
 
 
-def get_uri(resource):
-    return f'coap://[{RESOURCE_SERVER}]/{resource}'
+# Samples are batched and uploaded by a separate task, see main()
+uploader = None
 
 
-def post_to_thingsboard(resource_key, value, device=DEVICE_TOKEN):
-    try:
-        r = requests.post(get_thingsboard_uri(device), json={resource_key: value},
-                          headers=THINGSBOARD_HEADERS)
-        r.raise_for_status()
-    except requests.exceptions.HTTPError as err:
-        logging.warn(f"Error while posting data to Thingsboard: {err}")
+def post_to_thingsboard(resource_key, value, sample=None):
+    """
+    Queues a timestamped sample for upload, never blocks the event loop.
+    :param sample: tracing.Sample the value came from, for its timestamp and hop trace
+    """
+    if sample is None:
+        uploader.put(resource_key, value)
+    else:
+        uploader.put(resource_key, value, sample.ts(), sample.trace())
 
 
-async def get_sensor_data(protocol, resource):
-    uri = get_uri(resources[resource]["path"])
-    request = aiocoap.Message(code=aiocoap.GET, uri=uri)
-    response = await protocol.request(request).response
+node_limiters = {}
+# Created in main(), once the event loop runs
+global_limiter = None
+# Every GET goes through it, see cache.py
+cache = None
+# Polls all sensors of all nodes, see scheduler.py
+scheduler = None
+# Sequence numbers of the samples received, see tracing.py
+tracker = SequenceTracker()
+# Keeps the nodes' clocks in sync, see timesync.py
+timesync = None
 
-    return float(response.payload)
 
+def get_node_limiter(node):
+    """
+    Limits the requests in flight towards one node to NSTART, shared by all tasks
+    talking to that node, so adding resources does not overload a single mote.
+    """
+    if node not in node_limiters:
+        node_limiters[node] = asyncio.Semaphore(NSTART)
+    return node_limiters[node]
+
+
+@contextlib.asynccontextmanager
+async def request_slot(node):
+    """Holds one of the node's NSTART slots, for requests timed by the caller."""
+    async with global_limiter, get_node_limiter(node):
+        yield
 
-# GLOBAL CONFIG ===============================================================
+
+async def request_node(protocol, node, request):
+    """Sends a request once the node has a free NSTART slot, returns the first response."""
+    resource = "/".join(request.opt.uri_path)
+    queued = time.monotonic()
+    async with global_limiter, get_node_limiter(node):
+        sent = time.monotonic()
+        COAP_WAIT.observe(sent - queued, node)
+        try:
+            response = await protocol.request(request).response
+        except aiocoap.error.TimeoutError:
+            COAP_TIMEOUTS.inc(node, resource)
+            raise
+        except Exception:
+            COAP_ERRORS.inc(node, resource)
+            raise
+        COAP_RTT.observe(time.monotonic() - sent, node, resource)
+        return response
 
 
-moving = False
+# GLOBAL CONFIG ===============================================================
 
+
+# "path" is polled, "link" is how the resource shows up in .well-known/core;
+# poll periods are in schedule.json
 resources = {
     "temperature": {
-        "path": "my_res/sim_temperature",
-        "freq_if_moving": 1,
-        "freq_if_stopped": 10
+        "path": "s/t",
+        "link": "my_res/sim_temperature"
     },
     "rain": {
-        "path": "my_res/sim_rain",
-        "freq_if_moving": 1,
-        "freq_if_stopped": 10
+        "path": "s/r",
+        "link": "my_res/sim_rain"
     },
     "light": {
-        "path": "my_res/sim_light",
-        "freq_if_moving": 1,
-        "freq_if_stopped": 10
+        "path": "s/l",
+        "link": "my_res/sim_light"
     }
 }
 
-
-def accel_alarm_cb(response):
-    global moving
-    moving = bool(int(response.payload))
-    print(f"Moving changed to: {moving}")
-
-
-def generic_alarm_cb_factory(alarm_key):
-    def cb(response):
-        status = int(response.payload)
-        print(f"Alarm \"{alarm_key}\" changed to: {status}")
-        post_to_thingsboard(alarm_key, status)
-
-    return cb
-
+# All sensors in one SenML pack (resources/res-sensors.c), polled instead of the
+# single sensors when the node serves it and schedule.json has a "sensors" entry;
+# "names" maps record names (after the node's base name) to resources
+sensor_pack = {
+    "path": "s",
+    "link": "my_res/sensors",
+    "names": {"l": "light", "t": "temperature", "r": "rain"},
+}
+# CBOR pack in 32-byte blocks (Block2 SZX 1), each fits one 802.15.4 frame
+PACK_FORMAT = senml.CBOR_FORMAT
+PACK_BLOCK_SZX = 1
 
 alarms = {
     "accel": {
-        "path": "my_res/alarm_accel",
-        "callback":  accel_alarm_cb
+        "path": "a/ac",
+        "link": "my_res/alarm_accel",
     },
     "lights": {
-        "path": "my_res/alarm_lights",
-        "callback":  generic_alarm_cb_factory("light_alarm")
+        "path": "a/l",
+        "link": "my_res/alarm_lights",
+        "key": "light_alarm"
     },
     "freezing": {
-        "path": "my_res/alarm_freezing",
-        "callback":  generic_alarm_cb_factory("temperature_alarm")
+        "path": "a/f",
+        "link": "my_res/alarm_freezing",
+        "key": "temperature_alarm"
     },
     "traffic": {
-        "path": "my_res/alarm_traffic",
-        "callback":  generic_alarm_cb_factory("traffic_alarm")
+        "path": "a/tr",
+        "link": "my_res/alarm_traffic",
+        "key": "traffic_alarm"
     },
 }
 
 
+class Node:
+    """
+    One resource server: its poll schedules, observations, and whether it moves.
+    Telemetry keys get the node's suffix so several nodes can share a device.
+    """
+
+    def __init__(self, address, protocol, key_suffix=""):
+        self.address = address
+        self.protocol = protocol
+        self.key_suffix = key_suffix
+        self.moving = False
+        self.task = None
+
+    def start(self, discover=True):
+        self.task = asyncio.create_task(self.run(discover))
+
+    async def stop(self):
+        if self.task is None:
+            return
+        self.task.cancel()
+        await asyncio.gather(self.task, return_exceptions=True)
+        self.task = None
+
+    async def discover(self):
+        """Returns the names of the sensors and alarms the node serves, and whether it serves the sensor pack."""
+        request = aiocoap.Message(code=aiocoap.GET, uri=get_uri(self.address, ".well-known/core"))
+        response = await request_node(self.protocol, self.address, request)
+        links = parse_link_format(response.payload.decode(errors="replace"))
+
+        return ([name for name in resources if resources[name]["link"] in links],
+                [name for name in alarms if alarms[name]["link"] in links],
+                sensor_pack["link"] in links)
+
+    async def run(self, discover):
+        if discover:
+            while True:
+                try:
+                    sensor_names, alarm_names, serves_pack = await self.discover()
+                    break
+                except Exception as e:
+                    logging.warning(f"[{self.address}] .well-known/core failed: {e}")
+                    await asyncio.sleep(DISCOVERY_RETRY)
+        else:
+            sensor_names, alarm_names, serves_pack = list(resources), list(alarms), False
+
+        logging.info(f"[{self.address}] sensors: {sensor_names}, alarms: {alarm_names}")
+        # samples are timestamped by the node once its clock is set
+        sync_task = asyncio.create_task(timesync.run(self.address))
+        if serves_pack and "sensors" in scheduler.config["resources"]:
+            logging.info(f"[{self.address}] polling all sensors at once through {sensor_pack['link']}")
+            scheduler.add(self.address, "sensors", functools.partial(query_pack, self), lambda: self.moving)
+        else:
+            for name in sensor_names:
+                scheduler.add(self.address, name, functools.partial(query_sensor, self, name), lambda: self.moving)
+        try:
+            if alarm_names:
+                await observe_alarms(self, alarm_names)
+            else:
+                await asyncio.Event().wait()
+        finally:
+            scheduler.remove_node(self.address)
+            sync_task.cancel()
+
+    def post(self, key, value, sample=None):
+        post_to_thingsboard(key + self.key_suffix, value, sample)
+
+    async def get_sensor_data(self, resource):
+        """:return: tracing.Sample, None if it is the sample of the last poll (e.g. a cached response)"""
+        path = resources[resource]["path"]
+        entry = await cache.get(self.address, path)
+        sample = parse_sample(entry.payload, entry.received_ms)
+        if not tracker.check(self.address, path, sample):
+            return None
+        return sample
+
+    def alarm_callback(self, alarm):
+        def cb(response):
+            COAP_NOTIFICATIONS.inc(self.address, alarms[alarm]["path"])
+            cache.store(self.address, alarms[alarm]["path"], response)
+            sample = parse_sample(response.payload)
+            if not tracker.check(self.address, alarms[alarm]["path"], sample):
+                # a notification seen before, already handled
+                return
+            status = int(sample.value)
+            if alarm == "accel":
+                if self.moving != bool(status):
+                    self.moving = bool(status)
+                    # new periods, but not all nodes' polls at the same instant
+                    scheduler.rephase(self.address)
+                print(f"[{self.address}] Moving changed to: {self.moving}")
+            else:
+                print(f"[{self.address}] Alarm \"{alarms[alarm]['key']}\" changed to: {status}")
+                self.post(alarms[alarm]["key"], status, sample)
+
+        return cb
+
+
 # COROUTINES ==================================================================
 
 
-@asyncio.coroutine
-def query_sensor(resource):
-    def log(msg): return logging.debug(f"[query-sensor-{resource}] {msg}")
-    protocol = yield from aiocoap.Context.create_client_context()
+async def query_sensor(node, resource):
+    """One poll, started by the scheduler."""
+    def log(msg): return logging.debug(f"[query-sensor-{resource}-{node.address}] {msg}")
 
-    while True:
-        try:
-            log(f"Querying...")
-            try:
-                value = yield from get_sensor_data(protocol, resource)
-            except Exception as e:
-                logging.warning(f"Error while fetching sensor: {e}")
-            else:
-                post_to_thingsboard(resource, value)
-                log(f"Posted to Thingsboard (value: {value})")
+    log(f"Querying...")
+    try:
+        sample = await node.get_sensor_data(resource)
+    except Exception as e:
+        logging.warning(f"Error while fetching sensor: {e}")
+    else:
+        if sample is None:
+            log("Same sample as the last poll, not posted again")
+            return
+        node.post(resource, sample.value, sample)
+        log(f"Queued for Thingsboard (value: {sample.value}, seq: {sample.seq})")
+
+
+async def query_pack(node):
+    """One poll of all sensors, started by the scheduler; the records are posted as they are decoded."""
+    try:
+        entry = await cache.get(node.address, sensor_pack["path"], accept=PACK_FORMAT, block_szx=PACK_BLOCK_SZX)
+    except Exception as e:
+        logging.warning(f"Error while fetching sensor pack: {e}")
+        return
 
-            # Sleep
-            sleep_time = resources[resource]["freq_if_moving"] if moving else resources[resource]["freq_if_stopped"]
-            # log(f"Sleeping {sleep_time} secs before next query...")
-            yield from asyncio.sleep(sleep_time)
-        except asyncio.CancelledError:
-            break
+    def key(name):
+        return sensor_pack["names"].get(name.rpartition(":")[2])
 
+    for resource, value, ts in senml.telemetry(entry.payload, entry.content_format, key, entry.received_ms / 1000):
+        # without the node's time (no bt) the gateway stamps the sample
+        node.post(resource, value, Sample(value, node_ms=ts, received_ms=entry.received_ms))
+    logging.debug(f"[query-pack-{node.address}] Queued for Thingsboard")
 
-@asyncio.coroutine
-def observe_alarms():
-    protocol = yield from aiocoap.Context.create_client_context()
 
-    # Accel
-    alarm_keys = ["accel", "lights", "traffic", "freezing"]
+async def observe_alarms(node, alarm_keys):
     reqs = []
 
     for alarm_key in alarm_keys:
         req = aiocoap.Message(code=aiocoap.GET)
-        req.set_request_uri(get_uri(alarms[alarm_key]["path"]))
+        req.set_request_uri(get_uri(node.address, alarms[alarm_key]["path"]))
         req.opt.observe = 0
 
         try:
-            protocol_request = protocol.request(req)
-            protocol_request.observation.register_callback(
-                alarms[alarm_key]["callback"])
-            reqs.append(protocol_request)
-            response = yield from protocol_request.response
+            # only the registration counts against NSTART, notifications do not
+            async with global_limiter, get_node_limiter(node.address):
+                protocol_request = node.protocol.request(req)
+                protocol_request.observation.register_callback(
+                    node.alarm_callback(alarm_key))
+                reqs.append(protocol_request)
+                response = await protocol_request.response
         except Exception as e:
             print("Request failed: %s" % str(e))
         else:
-            alarms[alarm_key]["callback"](response)
+            node.alarm_callback(alarm_key)(response)
 
     while True:
         try:
-            yield from asyncio.sleep(30)
+            await asyncio.sleep(30)
         except asyncio.CancelledError:
             for protocol_req in reqs:
                 protocol_req.observation.cancel()
             break
 
 
-if __name__ == "__main__":
-    # Initialize event loop
-    event_loop = asyncio.new_event_loop()
-    asyncio.set_event_loop(event_loop)
+async def discover_nodes(protocol):
+    """
+    Polls the border router's route list, starts a Node for every address that
+    joined the DAG and stops the ones whose route expired.
+    """
+    nodes = {}
+    try:
+        while True:
+            try:
+                addresses = await fetch_routes(BORDER_ROUTER)
+            except (OSError, asyncio.TimeoutError) as e:
+                logging.warning(f"Could not fetch routes from {BORDER_ROUTER}: {e}")
+            else:
+                for address in addresses - nodes.keys():
+                    logging.info(f"Node joined: {address}")
+                    node = Node(address, protocol, key_suffix="-" + address.split(":")[-1])
+                    node.start()
+                    nodes[address] = node
+                for address in nodes.keys() - addresses:
+                    logging.info(f"Node left: {address}")
+                    await nodes.pop(address).stop()
+                    node_limiters.pop(address, None)
+                    tracker.forget(address)
+                    forget_node(address)
+
+            await asyncio.sleep(DISCOVERY_PERIOD)
+    finally:
+        await asyncio.gather(*(node.stop() for node in nodes.values()))
+
+
+async def poll_static_node(protocol):
+    """Legacy mode: one known node, every resource, plain telemetry keys."""
+    node = Node(RESOURCE_SERVER, protocol)
+    node.start(discover=False)
+    try:
+        await node.task
+    finally:
+        await node.stop()
+
+
+async def main():
+    global uploader, global_limiter, cache, scheduler, timesync
+    uploader = BatchUploader(DEVICE_TOKEN, SPOOL_DIR)
+    # periods stretch while uploads are backing up in the spool
+    scheduler = PollScheduler(SCHEDULE_CONFIG, uploader.backpressure)
+    global_limiter = asyncio.Semaphore(MAX_CONCURRENT_REQUESTS)
+
+    # One CoAP context (socket, message IDs, tokens, congestion state) for all tasks
+    protocol = await aiocoap.Context.create_client_context()
+    # samples come with their sequence number and node timestamp, see tracing.py
+    cache = ResponseCache(functools.partial(request_node, protocol), accept=JSON_FORMAT)
+    timesync = TimeSync(protocol, request_slot)
+    logging.getLogger("coap").addHandler(RetransmissionCounter())
+    register_gauges()
 
     # Define tasks
     tasks = [
-        query_sensor("light"),
-        query_sensor("rain"),
-        query_sensor("temperature"),
-        observe_alarms()
+        discover_nodes(protocol) if BORDER_ROUTER else poll_static_node(protocol),
+        scheduler.run(),
+        serve_http(cache, CACHE_HOST, CACHE_PORT),
+        metrics.serve_http(METRICS_HOST, METRICS_PORT),
+        uploader.run()
     ]
 
-    # Spawn tasks in the event loop
-    for task in tasks:
-        event_loop.create_task(task)
+    try:
+        await asyncio.gather(*tasks)
+    finally:
+        await protocol.shutdown()
+
 
-    # Run the event loop
-    asyncio.get_event_loop().run_forever()
+if __name__ == "__main__":
+    asyncio.run(main())
@@ -0,0 +1,150 @@
+/**
+ * \file
+ *      Non-blocking CoAP client that keeps several confirmable requests in flight.
+ */
+
+#include <string.h>
+#include "coap-pipeline.h"
+#include "lib/random.h"
+#include "sys/ctimer.h"
+
+#define DEBUG 0
+#if DEBUG
+#include <stdio.h>
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+struct coap_pipeline_slot {
+  coap_pipeline_callback_t callback;
+  void *data;
+  /* runs while the slot waits for a separate response */
+  struct ctimer separate_timer;
+  uint8_t token[COAP_PIPELINE_TOKEN_LEN];
+  uint8_t used;
+};
+
+static struct coap_pipeline_slot slots[COAP_PIPELINE_WINDOW];
+static uint8_t in_flight;
+static uint16_t next_token;
+
+/* Packets are serialized straight into the transaction, so one scratch request is enough. */
+static coap_packet_t request[1];
+
+static void
+finish(struct coap_pipeline_slot *slot, void *response)
+{
+  coap_pipeline_callback_t callback = slot->callback;
+  void *callback_data = slot->data;
+
+  /* Release the slot before the callback, as it may send the next request. */
+  ctimer_stop(&slot->separate_timer);
+  slot->used = 0;
+  in_flight--;
+
+  PRINTF("[coap-pipeline] %s, %u in flight\n", response ? "response" : "timeout", in_flight);
+
+  if(callback != NULL) {
+    callback(callback_data, response);
+  }
+}
+
+static void
+separate_timeout(void *data)
+{
+  PRINTF("[coap-pipeline] no separate response\n");
+  finish((struct coap_pipeline_slot *)data, NULL);
+}
+
+static void
+transaction_callback(void *data, void *response)
+{
+  struct coap_pipeline_slot *slot = (struct coap_pipeline_slot *)data;
+
+  if(response != NULL && ((coap_packet_t *)response)->code == 0) {
+    /* Empty ACK: the server got the request and answers it separately, not a response;
+     * the slot stays taken meanwhile, so the window also limits unanswered requests. */
+    PRINTF("[coap-pipeline] empty ACK, waiting for the separate response\n");
+    ctimer_set(&slot->separate_timer, COAP_PIPELINE_SEPARATE_TIMEOUT, separate_timeout, slot);
+    return;
+  }
+  finish(slot, response);
+}
+
+void
+coap_pipeline_init(void)
+{
+  memset(slots, 0, sizeof(slots));
+  in_flight = 0;
+  next_token = random_rand();
+}
+
+int
+coap_pipeline_post(uip_ipaddr_t *addr, uint16_t port, const char *uri_path,
+                   const uint8_t *payload, uint16_t payload_len,
+                   coap_pipeline_callback_t callback, void *data)
+{
+  struct coap_pipeline_slot *slot = NULL;
+  coap_transaction_t *transaction;
+  int i;
+
+  if(payload_len > REST_MAX_CHUNK_SIZE) {
+    PRINTF("[coap-pipeline] payload too large (%u)\n", payload_len);
+    return 0;
+  }
+
+  for(i = 0; i < COAP_PIPELINE_WINDOW; i++) {
+    if(!slots[i].used) {
+      slot = &slots[i];
+      break;
+    }
+  }
+  if(slot == NULL) {
+    return 0;
+  }
+
+  /* Matches a separate response to its request, unlike the MID. */
+  next_token++;
+  slot->token[0] = next_token >> 8;
+  slot->token[1] = next_token & 0xff;
+
+  coap_init_message(request, COAP_TYPE_CON, COAP_POST, coap_get_mid());
+  coap_set_token(request, slot->token, COAP_PIPELINE_TOKEN_LEN);
+  coap_set_header_uri_path(request, uri_path);
+  coap_set_header_content_format(request, APPLICATION_JSON);
+  coap_set_payload(request, payload, payload_len);
+
+  /* Transactions are shared with the server side, so this can fail even with a free slot. */
+  transaction = coap_new_transaction(request->mid, addr, port);
+  if(transaction == NULL) {
+    PRINTF("[coap-pipeline] no free transaction\n");
+    return 0;
+  }
+
+  slot->callback = callback;
+  slot->data = data;
+  slot->used = 1;
+  in_flight++;
+
+  transaction->callback = transaction_callback;
+  transaction->callback_data = slot;
+  transaction->packet_len = coap_serialize_message(request, transaction->packet);
+
+  /* Returns immediately: retransmissions run on the engine's timers. */
+  coap_send_transaction(transaction);
+
+  return 1;
+}
+
+uint8_t
+coap_pipeline_in_flight(void)
+{
+  return in_flight;
+}
+
+uint8_t
+coap_pipeline_available(void)
+{
+  return COAP_PIPELINE_WINDOW - in_flight;
+}
@@ -0,0 +1,69 @@
+/**
+ * \file
+ *      Non-blocking CoAP client that keeps several confirmable requests in flight.
+ *
+ *      COAP_BLOCKING_REQUEST() holds the calling process for a full round trip,
+ *      so only one request can be outstanding. The pipeline instead hands each
+ *      request to its own Erbium transaction and returns immediately; the engine
+ *      handles retransmissions and the result is delivered through a callback.
+ */
+
+#ifndef COAP_PIPELINE_H_
+#define COAP_PIPELINE_H_
+
+#include "contiki.h"
+#include "contiki-net.h"
+#include "er-coap-engine.h"
+
+/* Maximum number of requests in flight at the same time. */
+#ifdef COAP_PIPELINE_CONF_WINDOW
+#define COAP_PIPELINE_WINDOW COAP_PIPELINE_CONF_WINDOW
+#else
+#define COAP_PIPELINE_WINDOW 4
+#endif
+
+/* Time a request acknowledged with an empty ACK keeps its slot, in clock ticks. */
+#ifdef COAP_PIPELINE_CONF_SEPARATE_TIMEOUT
+#define COAP_PIPELINE_SEPARATE_TIMEOUT COAP_PIPELINE_CONF_SEPARATE_TIMEOUT
+#else
+#define COAP_PIPELINE_SEPARATE_TIMEOUT (10 * CLOCK_SECOND)
+#endif
+
+/* Bytes of the token every request carries. */
+#define COAP_PIPELINE_TOKEN_LEN 2
+
+/* Keep at least one transaction free for the server side (separate responses, notifications). */
+#if COAP_PIPELINE_WINDOW >= COAP_MAX_OPEN_TRANSACTIONS
+#error "COAP_PIPELINE_WINDOW must be smaller than COAP_MAX_OPEN_TRANSACTIONS"
+#endif
+
+/*
+ * Called exactly once per request, from the CoAP engine process.
+ * response is the received coap_packet_t, never an empty ACK, or NULL if the
+ * request timed out after COAP_MAX_RETRANSMIT retransmissions, or if it was
+ * acknowledged with an empty ACK, once COAP_PIPELINE_SEPARATE_TIMEOUT passed:
+ * Erbium's engine delivers responses by MID only, so the separate response
+ * does not reach the pipeline.
+ * The pipeline slot is already released when the callback runs, so it may
+ * queue the next request right away.
+ */
+typedef void (*coap_pipeline_callback_t)(void *data, void *response);
+
+void coap_pipeline_init(void);
+
+/*
+ * Send a confirmable POST with a JSON payload.
+ * Returns 1 if the request was sent, 0 if the window is full, no transaction
+ * is available or the payload does not fit into REST_MAX_CHUNK_SIZE.
+ */
+int coap_pipeline_post(uip_ipaddr_t *addr, uint16_t port, const char *uri_path,
+                       const uint8_t *payload, uint16_t payload_len,
+                       coap_pipeline_callback_t callback, void *data);
+
+/* Number of requests currently waiting for a response. */
+uint8_t coap_pipeline_in_flight(void);
+
+/* Number of requests that can still be sent before the window is full. */
+uint8_t coap_pipeline_available(void);
+
+#endif /* COAP_PIPELINE_H_ */
@@ -0,0 +1,328 @@
+/**
+ * \file
+ *      Direct telemetry uplink from the resource server to ThingsBoard.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "contiki.h"
+#include "contiki-net.h"
+#include "er-coap-engine.h"
+
+#include "coap-pipeline.h"
+#include "direct-telemetry.h"
+#include "resources/extern_var.h"
+#include "resources/res-sim-light.h"
+#include "resources/res-sim-rain.h"
+#include "resources/res-sim-temperature.h"
+#include "resources/res-time.h"
+
+#define DEBUG 0
+#if DEBUG
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+/* THINGSBOARD address, see post-to-thingsboard.c */
+#define SERVER_NODE(ipaddr)   uip_ip6addr(ipaddr, 0x2001, 0x0660, 0x330f, 0xb040, 0, 0, 0, 0x0004)
+#define REMOTE_PORT           UIP_HTONS(COAP_DEFAULT_PORT)
+
+#define TELEMETRY_URL         "api/v1/" DIRECT_TELEMETRY_TOKEN "/telemetry"
+
+/* Payload needed by one timestamped record with the longest entry, in its array */
+#define TIMESTAMPED_RECORD_MAX 56
+
+/* Room kept free for closing the payload ("}}]" or "}"). */
+#define CLOSING_LEN(timestamped) ((timestamped) ? 3 : 1)
+
+/* ThingsBoard keys, matching the ones posted by client.py. */
+enum telemetry_key {
+  KEY_LIGHT,
+  KEY_TEMPERATURE,
+  KEY_RAIN,
+  KEY_LIGHT_ALARM,
+  KEY_TEMPERATURE_ALARM,
+  KEY_TRAFFIC_ALARM,
+  KEY_COUNT
+};
+
+static const char *key_names[] = {
+  "light",
+  "temperature",
+  "rain",
+  "light_alarm",
+  "temperature_alarm",
+  "traffic_alarm",
+};
+
+struct telemetry_entry {
+  clock_time_t time;
+  float value;
+  uint8_t key;
+};
+
+static struct telemetry_entry queue[DIRECT_TELEMETRY_QUEUE_SIZE];
+static uint8_t queue_head;
+static uint8_t queue_count;
+
+static uip_ipaddr_t server_ipaddr;
+static char payload[DIRECT_TELEMETRY_PAYLOAD_MAX + 1];
+
+static int last_lights_alarm_status;
+static int last_freezing_alarm_status;
+static int last_traffic_alarm_status;
+
+static uint16_t entries_dropped;
+static uint16_t posts_lost;
+
+PROCESS(direct_telemetry_process, "Direct ThingsBoard telemetry");
+
+static void
+queue_push(clock_time_t time, uint8_t key, float value)
+{
+  struct telemetry_entry *entry;
+
+  if (queue_count == DIRECT_TELEMETRY_QUEUE_SIZE) {
+    // drop the oldest entry
+    queue_head = (queue_head + 1) % DIRECT_TELEMETRY_QUEUE_SIZE;
+    queue_count--;
+    entries_dropped++;
+  }
+  entry = &queue[(queue_head + queue_count) % DIRECT_TELEMETRY_QUEUE_SIZE];
+  entry->time = time;
+  entry->key = key;
+  entry->value = value;
+  queue_count++;
+}
+
+static void
+sample_sensors(void)
+{
+  clock_time_t now = clock_time();
+
+  queue_push(now, KEY_LIGHT, get_light_sensor_value());
+  queue_push(now, KEY_TEMPERATURE, get_temperature_sensor_value());
+  queue_push(now, KEY_RAIN, get_rain_sensor_value());
+}
+
+/* Returns 1 if any alarm changed since the last call. */
+static int
+record_alarm_changes(void)
+{
+  clock_time_t now = clock_time();
+  int changed = 0;
+
+  if (lights_alarm_status != last_lights_alarm_status) {
+    last_lights_alarm_status = lights_alarm_status;
+    queue_push(now, KEY_LIGHT_ALARM, lights_alarm_status);
+    changed = 1;
+  }
+  if (freezing_alarm_status != last_freezing_alarm_status) {
+    last_freezing_alarm_status = freezing_alarm_status;
+    queue_push(now, KEY_TEMPERATURE_ALARM, freezing_alarm_status);
+    changed = 1;
+  }
+  if (traffic_alarm_status != last_traffic_alarm_status) {
+    last_traffic_alarm_status = traffic_alarm_status;
+    queue_push(now, KEY_TRAFFIC_ALARM, traffic_alarm_status);
+    changed = 1;
+  }
+  return changed;
+}
+
+/* Appends to payload; returns the new length, or -1 if it does not fit before limit. */
+static int
+append(int len, int limit, const char *fmt, ...)
+{
+  va_list args;
+  int written;
+
+  if (len < 0 || len >= limit) {
+    return -1;
+  }
+  va_start(args, fmt);
+  written = vsnprintf(payload + len, limit - len, fmt, args);
+  va_end(args);
+  if (written < 0 || len + written >= limit) {
+    return -1;
+  }
+  return len + written;
+}
+
+static int
+append_value(int len, int limit, const struct telemetry_entry *entry)
+{
+  if (entry->key == KEY_RAIN) {
+    return append(len, limit, "\"%s\":%.2f", key_names[entry->key], entry->value);
+  }
+  return append(len, limit, "\"%s\":%d", key_names[entry->key], (int)entry->value);
+}
+
+/*
+ * Encodes as many queued entries as fit into one payload.
+ * Timestamped, entries sampled together form one {"ts":..,"values":{..}}
+ * record and records are packed into an array.
+ * Otherwise a single flat {key:value} record is sent and ThingsBoard
+ * stamps it on arrival.
+ * Returns the payload length and sets *consumed to the number of entries used.
+ */
+static int
+encode_payload(uint8_t *consumed, int timestamped)
+{
+  int limit = DIRECT_TELEMETRY_PAYLOAD_MAX - CLOSING_LEN(timestamped);
+  int len = 0, next, record_open = 0;
+  clock_time_t record_time = 0;
+  const struct telemetry_entry *entry;
+  unsigned long seconds;
+  uint16_t ms;
+  uint8_t i;
+
+  if (timestamped) {
+    len = append(len, limit, "[");
+  } else {
+    len = append(len, limit, "{");
+  }
+
+  for (i = 0; i < queue_count; i++) {
+    entry = &queue[(queue_head + i) % DIRECT_TELEMETRY_QUEUE_SIZE];
+
+    if (record_open && entry->time == record_time) {
+      next = append(len, limit, ",");
+    } else if (!timestamped) {
+      if (record_open) {
+        // flat records carry no time, so only one fits per payload
+        break;
+      }
+      next = len;
+    } else {
+      next = append(len, limit, record_open ? "}},{" : "{");
+      node_time_from_ticks(entry->time, &seconds, &ms);
+      next = append(next, limit, "\"ts\":%u%03u,\"values\":{", (unsigned int)seconds, ms);
+    }
+    next = append_value(next, limit, entry);
+    if (next < 0) {
+      break;
+    }
+    len = next;
+    record_open = 1;
+    record_time = entry->time;
+  }
+
+  *consumed = i;
+  if (i == 0) {
+    return 0;
+  }
+
+  // the reserved room always fits the closing brackets
+  limit = DIRECT_TELEMETRY_PAYLOAD_MAX + 1;
+  return append(len, limit, timestamped ? "}}]" : "}");
+}
+
+static void
+post_callback(void *data, void *response)
+{
+  if (response == NULL) {
+    posts_lost++;
+    printf("[direct-telemetry] post timed out (%u lost)\n", posts_lost);
+  }
+  // a slot was freed, continue flushing
+  process_poll(&direct_telemetry_process);
+}
+
+static void
+flush(void)
+{
+  uint8_t consumed;
+  int len;
+
+  while (queue_count > 0 && coap_pipeline_available() > 0) {
+    len = encode_payload(&consumed, batched());
+    if (consumed == 0) {
+      // should not happen, a single entry always fits
+      queue_head = (queue_head + 1) % DIRECT_TELEMETRY_QUEUE_SIZE;
+      queue_count--;
+      entries_dropped++;
+      continue;
+    }
+    if (!coap_pipeline_post(&server_ipaddr, REMOTE_PORT, TELEMETRY_URL,
+                            (uint8_t *)payload, len, post_callback, NULL)) {
+      // retried when the next slot is freed
+      break;
+    }
+    PRINTF("[direct-telemetry] posted %u entries: %s\n", consumed, payload);
+    queue_head = (queue_head + consumed) % DIRECT_TELEMETRY_QUEUE_SIZE;
+    queue_count -= consumed;
+  }
+}
+
+/*
+ * Returns 1 if entries are timestamped and wait for the flush to be posted in
+ * batches; flat entries are stamped on arrival, so they are posted right away.
+ */
+static int
+batched(void)
+{
+  return DIRECT_TELEMETRY_PAYLOAD_MAX >= TIMESTAMPED_RECORD_MAX && node_time_is_set();
+}
+
+static clock_time_t
+sample_interval(void)
+{
+  if (accel_alarm_status) {
+    return CLOCK_SECOND * DIRECT_TELEMETRY_SAMPLE_MOVING_SECS;
+  }
+  return CLOCK_SECOND * DIRECT_TELEMETRY_SAMPLE_STOPPED_SECS;
+}
+
+void
+direct_telemetry_init(void)
+{
+  process_start(&direct_telemetry_process, NULL);
+}
+
+PROCESS_THREAD(direct_telemetry_process, ev, data)
+{
+  static struct etimer sample_timer;
+  static struct etimer flush_timer;
+
+  PROCESS_BEGIN();
+
+  SERVER_NODE(&server_ipaddr);
+  coap_pipeline_init();
+
+  last_lights_alarm_status = lights_alarm_status;
+  last_freezing_alarm_status = freezing_alarm_status;
+  last_traffic_alarm_status = traffic_alarm_status;
+
+  etimer_set(&sample_timer, sample_interval());
+  etimer_set(&flush_timer, CLOCK_SECOND * DIRECT_TELEMETRY_FLUSH_SECS);
+
+  while(1) {
+    PROCESS_WAIT_EVENT();
+
+    if (ev == PROCESS_EVENT_TIMER && data == &sample_timer) {
+      sample_sensors();
+      // alarm changes are pushed right away
+      if (record_alarm_changes() || !batched()) {
+        flush();
+      }
+      // follows the moving state, like the gateway's polling
+      etimer_set(&sample_timer, sample_interval());
+    } else if (ev == PROCESS_EVENT_TIMER && data == &flush_timer) {
+      flush();
+      etimer_reset(&flush_timer);
+      PRINTF("[direct-telemetry] %u queued, %u dropped, %u lost\n", queue_count, entries_dropped, posts_lost);
+    } else if (ev == PROCESS_EVENT_POLL) {
+      flush();
+    }
+
+    // flush early, before the next sampling round starts dropping entries
+    if (queue_count > DIRECT_TELEMETRY_QUEUE_SIZE - KEY_COUNT) {
+      flush();
+    }
+  }
+
+  PROCESS_END();
+}
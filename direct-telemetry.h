@@ -0,0 +1,68 @@
+/**
+ * \file
+ *      Direct telemetry uplink from the resource server to ThingsBoard.
+ *
+ *      Samples the simulated sensors on its own schedule, records alarm
+ *      changes and posts timestamped batches to ThingsBoard's CoAP device API
+ *      (/api/v1/<token>/telemetry), without going through client.py.
+ *      Enabled with make WITH_DIRECT_TELEMETRY=1.
+ */
+
+#ifndef DIRECT_TELEMETRY_H_
+#define DIRECT_TELEMETRY_H_
+
+#include "contiki.h"
+
+/* ThingsBoard device access token. */
+#ifdef DIRECT_TELEMETRY_CONF_TOKEN
+#define DIRECT_TELEMETRY_TOKEN DIRECT_TELEMETRY_CONF_TOKEN
+#else
+#define DIRECT_TELEMETRY_TOKEN "MONITOKEN"
+#endif
+
+/*
+ * Largest payload of a telemetry POST. The default keeps a POST with the
+ * default 9-character token in one 802.15.4 frame (make frame-budget checks
+ * it), a longer token needs a smaller value.
+ * Batches of timestamped records need at least 56 bytes. Below that, entries
+ * are posted as flat {key:value} records as soon as they are sampled and
+ * ThingsBoard stamps them on arrival.
+ */
+#ifdef DIRECT_TELEMETRY_CONF_PAYLOAD_MAX
+#define DIRECT_TELEMETRY_PAYLOAD_MAX DIRECT_TELEMETRY_CONF_PAYLOAD_MAX
+#else
+#define DIRECT_TELEMETRY_PAYLOAD_MAX 34
+#endif
+
+/* Sensor sampling period while moving / stopped, same as client.py. */
+#ifdef DIRECT_TELEMETRY_CONF_SAMPLE_MOVING_SECS
+#define DIRECT_TELEMETRY_SAMPLE_MOVING_SECS DIRECT_TELEMETRY_CONF_SAMPLE_MOVING_SECS
+#else
+#define DIRECT_TELEMETRY_SAMPLE_MOVING_SECS 1
+#endif
+
+#ifdef DIRECT_TELEMETRY_CONF_SAMPLE_STOPPED_SECS
+#define DIRECT_TELEMETRY_SAMPLE_STOPPED_SECS DIRECT_TELEMETRY_CONF_SAMPLE_STOPPED_SECS
+#else
+#define DIRECT_TELEMETRY_SAMPLE_STOPPED_SECS 10
+#endif
+
+/* Buffered samples are flushed at least this often, and on every alarm change. */
+#ifdef DIRECT_TELEMETRY_CONF_FLUSH_SECS
+#define DIRECT_TELEMETRY_FLUSH_SECS DIRECT_TELEMETRY_CONF_FLUSH_SECS
+#else
+#define DIRECT_TELEMETRY_FLUSH_SECS 30
+#endif
+
+/* Number of buffered key/value entries; the oldest are dropped when full. */
+#ifdef DIRECT_TELEMETRY_CONF_QUEUE_SIZE
+#define DIRECT_TELEMETRY_QUEUE_SIZE DIRECT_TELEMETRY_CONF_QUEUE_SIZE
+#else
+#define DIRECT_TELEMETRY_QUEUE_SIZE 48
+#endif
+
+PROCESS_NAME(direct_telemetry_process);
+
+void direct_telemetry_init(void);
+
+#endif /* DIRECT_TELEMETRY_H_ */
@@ -0,0 +1,56 @@
+"""
+Discovery of resource servers for the gateway.
+
+The border router's web page lists the routes of the RPL DAG (storing mode)
+or its links (non-storing mode); every node in there is a candidate resource
+server. Its resources are learned from CoAP .well-known/core.
+"""
+import asyncio
+import ipaddress
+import re
+
+
+# Route entries: "<address>/128 (via <next hop>) <lifetime>s"
+ROUTE_RE = re.compile(r"^([0-9a-fA-F:]+)/128 \(via ", re.M)
+# Non-storing links: "<child> (parent: <parent>) <lifetime>s"
+LINK_RE = re.compile(r"^([0-9a-fA-F:]+) \(parent: ", re.M)
+# Link-format target: </path>;attributes
+LINK_TARGET_RE = re.compile(r"<([^>]*)>")
+
+
+def parse_routes(page):
+    """
+    Extracts node addresses from the border router's page.
+    :param page: HTML served by border-router.c
+    :return: set of compressed IPv6 addresses
+    """
+    addresses = set()
+    for match in ROUTE_RE.findall(page) + LINK_RE.findall(page):
+        try:
+            addresses.add(ipaddress.IPv6Address(match).compressed)
+        except ipaddress.AddressValueError:
+            continue
+    return addresses
+
+
+def parse_link_format(payload):
+    """
+    Extracts resource paths from a .well-known/core response.
+    :return: set of paths without leading slash, e.g. {"my_res/sim_light"}
+    """
+    return {target.lstrip("/") for target in LINK_TARGET_RE.findall(payload)}
+
+
+async def fetch_routes(border_router, timeout=10):
+    """
+    Fetches the border router's page and returns the addresses of its nodes.
+    The border router's web server is tiny, so plain HTTP/1.0 is enough.
+    """
+    reader, writer = await asyncio.wait_for(asyncio.open_connection(border_router, 80), timeout)
+    try:
+        writer.write(f"GET / HTTP/1.0\r\nHost: [{border_router}]\r\n\r\n".encode())
+        await writer.drain()
+        page = await asyncio.wait_for(reader.read(), timeout)
+    finally:
+        writer.close()
+    return parse_routes(page.decode(errors="replace"))
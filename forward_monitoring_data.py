@@ -1,15 +1,30 @@
+import concurrent.futures
+import queue
 import subprocess
 import json
 import os
+import sys
+import threading
+import traceback
 from time import sleep
-import requests
+
+from aggregate import WindowAggregator
+from oml_tail import OmlTailer
+from spool import Spool
+from thingsboard import backpressure, drain_spool, make_session
 
 THINGSBOARD_TOKEN = "MONITOKEN2"
-THINGSBOARD_URL = "http://mauro.rezel.net:8080/api/v1/{}/telemetry".format(THINGSBOARD_TOKEN)
 HOME = os.environ.get("HOME")
+SPOOL_DIR = HOME + "/.gin206/spool/forward"  # datapoints wait here (one spool per node) until ThingsBoard acknowledged them
 MONITORING_DATA_PATH = HOME + "/.iot-lab/{}/{}/{}.oml"  # fill experiment id, type of monitoring, node id
+OML_OFFSETS_PATH = HOME + "/.gin206/forward-offsets.json"  # how far each .oml file was forwarded
 UPDATE_FREQ = 5  # in seconds
-ENERGY_MSG_RATE = 10  # use every xth datapoint. Forwarding is not fast enough to use all data.
+UPLOAD_BATCH = 500  # timestamped records per upload
+MAX_PARALLEL_UPLOADS = 8  # nodes uploading at the same time
+PARSE_WORKERS = 4  # threads turning .oml lines into spooled messages
+PARSE_QUEUE_SIZE = 64  # batches read but not parsed yet, readers wait beyond
+# datapoints are uploaded as min/max/mean (+ energy) per window of that many ms, 0 uploads every datapoint
+AGGREGATE_WINDOW_MS = int(os.environ.get("FORWARD_AGGREGATE_MS", 1000))
 
 
 def get_experiment_info():
@@ -30,32 +45,14 @@ def get_experiment_info():
         raise
 
 
-def get_monitoring_data(exp_id, monitoring_type, node):
+def get_monitoring_data_path(exp_id, monitoring_type, node):
     """
-    Retrieve monitoring data from OML file.
     :param exp_id: ID of monitored experiment
     :param monitoring_type: One of ["consumption", "radio"]
     :param node: ID of node, e.g., m3-100
-    :return: List of monitoring data separated into lines
-    """
-    with open(MONITORING_DATA_PATH.format(exp_id, monitoring_type, node)) as file:
-        monitoring_data = _get_oml_lines(file.read())
-    return monitoring_data
-
-
-def _get_oml_lines(oml_content):
-    """
-    Strips oml header and returns only lines containing monitoring data in a list.
-    :param oml_content: raw oml file content
-    :return: list of monitoring data separated into lines
+    :return: path of the node's OML file
     """
-    all_oml_lines = oml_content.splitlines()
-    # split at empty line
-    if "" not in all_oml_lines:
-        raise RuntimeError("Error: Could not parse data."
-                           " Maybe you just started the experiment and there is not enough data yet?")
-    usable_oml_lines = all_oml_lines[all_oml_lines.index("")+1:]
-    return usable_oml_lines
+    return MONITORING_DATA_PATH.format(exp_id, monitoring_type, node)
 
 
 def make_energy_telemetry_msg(datapoint, node):
@@ -67,10 +64,10 @@ def make_energy_telemetry_msg(datapoint, node):
     """
     fields = datapoint.split()
     try:
-        timestamp = fields[3] + fields[4][:3]
-        current, voltage, power = fields[5], fields[6], fields[7]
-    except IndexError:
-        print("Error: malformed radio datapoint?", datapoint)
+        timestamp = int(fields[3]) * 1000 + int(fields[4]) // 1000
+        power, voltage, current = fields[5:8]
+    except (IndexError, ValueError):
+        print("Error: malformed energy datapoint?", datapoint)
         raise
     msg = {"ts": timestamp, "values": {
         f"current-{node}": current,
@@ -89,56 +86,173 @@ def make_radio_telemetry_msg(datapoint, node):
     """
     fields = datapoint.split()
     try:
-        timestamp = fields[3] + fields[4][:3]
+        timestamp = int(fields[3]) * 1000 + int(fields[4]) // 1000
         channel = fields[5]
         rssi = fields[6]
-    except IndexError:
+    except (IndexError, ValueError):
         print("Error: malformed radio datapoint?", datapoint)
         raise
-    msg = {"ts": timestamp, "values": {f"{channel}-{node}": rssi}}
+    msg = {"ts": timestamp, "values": {f"rssi-{channel}-{node}": rssi}}
     return msg
 
 
-def send_to_thingsboard(telemetry_msg):
+# node -> its Spool, upload session and the lock serializing the spool between the
+# parse and upload stages; "" is the single spool of previous versions, drained but no longer filled
+spools = {"": Spool(SPOOL_DIR)}
+sessions = {"": make_session(THINGSBOARD_TOKEN)}
+spool_locks = {"": threading.Lock()}
+
+
+def get_spool(node):
+    """Creates the node's spool on first use; all nodes are set up by main() before the stages start."""
+    if node not in spools:
+        spools[node] = Spool(os.path.join(SPOOL_DIR, node))
+        sessions[node] = make_session(THINGSBOARD_TOKEN, instance=node)
+        spool_locks[node] = threading.Lock()
+    return spools[node]
+
+
+def send_to_thingsboard(node, telemetry_msg):
+    """
+    Queue a single message for the ThingsBoard device defined globally.
+    It is written to the node's spool and uploaded by the upload stage.
+    :param node: monitored node the message is about
+    :param telemetry_msg: json-like dict with "ts" and "values"
+    """
+    get_spool(node).append(telemetry_msg)
+
+
+# (monitoring type, node) -> its WindowAggregator; a window is uploaded once a later datapoint closes it
+aggregators = {}
+
+
+def forward(monitoring_type, node, telemetry_msg):
+    """
+    Queue a datapoint, as is or through the window aggregation of its node and monitoring type.
+    Power is integrated to energy (J per window), RSSI is aggregated per channel (one key each).
+    """
+    if not AGGREGATE_WINDOW_MS:
+        send_to_thingsboard(node, telemetry_msg)
+        return
+    aggregator = aggregators.get((monitoring_type, node))
+    if aggregator is None:
+        aggregator = aggregators[(monitoring_type, node)] = WindowAggregator(AGGREGATE_WINDOW_MS, {"power": "energy"})
+    for record in aggregator.add(int(telemetry_msg["ts"]), telemetry_msg["values"]):
+        send_to_thingsboard(node, record)
+
+
+# PIPELINE ====================================================================
+#
+# reader (one thread per node) --parse_queue--> parse workers --> node's spool
+#                              --upload_queue--> upload workers --> ThingsBoard
+#
+# A reader has at most one batch in flight, so a node's datapoints are parsed in
+# order (its aggregators are never shared) and a slow node only holds its own reader.
+
+MAKE_TELEMETRY_MSG = {"consumption": make_energy_telemetry_msg, "radio": make_radio_telemetry_msg}
+
+parse_queue = queue.Queue(maxsize=PARSE_QUEUE_SIZE)
+upload_queue = queue.Queue()
+# node -> "queued", "running" or "again" (new data arrived while it was uploading)
+upload_state = {}
+upload_state_lock = threading.Lock()
+
+
+def schedule_upload(node):
+    """Queues the node for the upload stage, at most once at a time."""
+    with upload_state_lock:
+        state = upload_state.get(node)
+        if state is None:
+            upload_state[node] = "queued"
+            upload_queue.put(node)
+        elif state == "running":
+            upload_state[node] = "again"
+
+
+def upload_worker():
     """
-    Send a single message to the ThingsBoard endpoint defined globally
-    :param telemetry_msg: list of dicts or json-like dict with values to send
+    Uploads the spooled messages of queued nodes in batches. If ThingsBoard is unreachable
+    they stay spooled (also across restarts) and are retried when main() queues the node again.
     """
-    r = requests.post(THINGSBOARD_URL, json=telemetry_msg)
-    if r.status_code != 200:
-        raise RuntimeError("Could not send message {} to ThingsBoard URL {}".format(
-            telemetry_msg, THINGSBOARD_URL
-        ))
+    while True:
+        node = upload_queue.get()
+        with upload_state_lock:
+            upload_state[node] = "running"
+        try:
+            drain_spool(spools[node], sessions[node], UPLOAD_BATCH, spool_locks[node])
+        except Exception:
+            # the records stay spooled, main() queues the node again
+            print(f"Error: upload of node {node} failed")
+            traceback.print_exc()
+        finally:
+            with upload_state_lock:
+                if upload_state.pop(node) == "again":
+                    upload_state[node] = "queued"
+                    upload_queue.put(node)
+
+
+def parse_worker():
+    """Turns the lines of a batch into messages and spools them, then resolves the batch's future."""
+    while True:
+        node, batch, done = parse_queue.get()
+        try:
+            with spool_locks[node]:
+                for monitoring_type, lines in batch:
+                    for datapoint in lines:
+                        forward(monitoring_type, node, MAKE_TELEMETRY_MSG[monitoring_type](datapoint, node))
+                spools[node].sync()
+            done.set_result(None)
+        except Exception as err:
+            done.set_exception(err)
+
+
+def reader(exp_id, node, tailer):
+    """
+    Reads the lines appended to the node's .oml files and hands them to the parse stage.
+    The offsets move on only once their datapoints are safely spooled
+    (the datapoints of a still open window are lost on a restart, at most one window).
+    """
+    paths = {monitoring_type: get_monitoring_data_path(exp_id, monitoring_type, node)
+             for monitoring_type in MAKE_TELEMETRY_MSG}
+    while True:
+        batch = [(monitoring_type, tailer.read(path)) for monitoring_type, path in paths.items()]
+        if not any(lines for _, lines in batch):
+            # read less often while uploads are backing up in the node's spool
+            sleep(UPDATE_FREQ * backpressure(spools[node]))
+            continue
+        done = concurrent.futures.Future()
+        parse_queue.put((node, batch, done))  # blocks while the parse workers are behind
+        done.result()
+        tailer.commit(paths.values())
+        schedule_upload(node)
+
+
+def start_thread(target, *args):
+    thread = threading.Thread(target=target, args=args, daemon=True)
+    thread.start()
+    return thread
 
 
 def main():
     # initial setup
     exp_id, nodes_list = get_experiment_info()
-    last_datapoint_index = {node: {"consumption": 0, "radio": 0} for node in nodes_list}
-    while True:
-        energy_monitoring_data = {node: get_monitoring_data(exp_id, "consumption", node) for node in nodes_list}
-        radio_monitoring_data = {node: get_monitoring_data(exp_id, "radio", node) for node in nodes_list}
-        # send all new data points to Thingsboard
-        # 1. energy
-        for node, node_data in energy_monitoring_data.items():
-            start_idx = last_datapoint_index[node]["consumption"] + 1
-            # the final node is usually still incompletely written, so we skip it in this iteration
-            for datapoint in node_data[start_idx:-1:ENERGY_MSG_RATE]:
-                telemetry_msg = make_energy_telemetry_msg(datapoint, node)
-                send_to_thingsboard(telemetry_msg)
-            # save the latest datapoint so it is not resent
-            last_datapoint_index[node]["consumption"] = len(node_data)
-        # 2. radio
-        # for node, node_data in radio_monitoring_data.items():
-        #     start_idx = last_datapoint_index[node]["radio"] + 1
-        #     # the final node is usually still incompletely written, so we skip it in this iteration
-        #     for datapoint in node_data[start_idx:-1]:
-        #         telemetry_msg = make_radio_telemetry_msg(datapoint, node)
-        #         send_to_thingsboard(telemetry_msg)
-        #     # save the latest datapoint so it is not resent
-        #     last_datapoint_index[node]["radio"] = len(node_data)
+    for node in nodes_list:
+        get_spool(node)
+    # only the lines appended since the last read are read, see oml_tail.py
+    tailer = OmlTailer(OML_OFFSETS_PATH)
+    for _ in range(PARSE_WORKERS):
+        start_thread(parse_worker)
+    uploaders = [start_thread(upload_worker) for _ in range(MAX_PARALLEL_UPLOADS)]
+    readers = [start_thread(reader, exp_id, node, tailer) for node in nodes_list]
+    # the readers queue their node after each batch, this retries failed uploads
+    # and drains the spools left by a previous run
+    while all(thread.is_alive() for thread in readers + uploaders):
+        for node in spools:
+            schedule_upload(node)
         sleep(UPDATE_FREQ)
+    print("Error: a reader or upload worker stopped, see the traceback above")
+    sys.exit(1)
 
 
 if __name__ == "__main__":
-    main()
\ No newline at end of file
+    main()
@@ -0,0 +1,159 @@
+"""
+Gateway metrics in the Prometheus text format (version 0.0.4).
+
+Modules create their metrics at import time with counter(), gauge() and
+histogram(); values that already exist elsewhere (spool size, cache hits)
+are read at scrape time through gauge callbacks. serve_http() exposes
+everything at /metrics.
+"""
+import asyncio
+import logging
+import math
+
+
+# All metrics, in registration order
+REGISTRY = []
+
+# Seconds, from a one-hop CoAP exchange up to the last CON retransmission
+LATENCY_BUCKETS = (0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 120)
+# Samples per upload
+SIZE_BUCKETS = (1, 5, 10, 25, 50, 100, 200, 500, 1000)
+
+
+def _escape(value):
+    return str(value).replace("\\", "\\\\").replace("\"", "\\\"").replace("\n", "\\n")
+
+
+def _format_labels(names, values, extra=()):
+    pairs = [f'{name}="{_escape(value)}"' for name, value in list(zip(names, values)) + list(extra)]
+    return "{" + ",".join(pairs) + "}" if pairs else ""
+
+
+def _format_value(value):
+    if value == math.inf:
+        return "+Inf"
+    return repr(float(value)) if isinstance(value, float) else str(value)
+
+
+class Metric:
+    kind = "untyped"
+
+    def __init__(self, name, help_text, labels=(), callback=None):
+        """callback: returns {label values tuple: value}, called at every scrape"""
+        self.name = name
+        self.help_text = help_text
+        self.labels = tuple(labels)
+        self.callback = callback
+        self.values = {}
+        REGISTRY.append(self)
+
+    def forget(self, label, value):
+        """Drops every label combination where label has value, e.g. of a node that left."""
+        if label in self.labels:
+            i = self.labels.index(label)
+            self.values = {key: state for key, state in self.values.items() if key[i] != value}
+
+    def render(self):
+        if self.callback is not None:
+            self.values = self.callback()
+        lines = [f"# HELP {self.name} {self.help_text}", f"# TYPE {self.name} {self.kind}"]
+        for label_values, value in sorted(self.values.items()):
+            lines.append(f"{self.name}{_format_labels(self.labels, label_values)} {_format_value(value)}")
+        return lines
+
+
+class Counter(Metric):
+    kind = "counter"
+
+    def inc(self, *label_values, amount=1):
+        self.values[label_values] = self.values.get(label_values, 0) + amount
+
+
+class Gauge(Metric):
+    kind = "gauge"
+
+    def set(self, value, *label_values):
+        self.values[label_values] = value
+
+
+class Histogram(Metric):
+    kind = "histogram"
+
+    def __init__(self, name, help_text, labels=(), buckets=LATENCY_BUCKETS):
+        super().__init__(name, help_text, labels)
+        self.buckets = tuple(buckets) + (math.inf,)
+
+    def observe(self, value, *label_values):
+        # per bucket counts (not cumulative), then sum
+        state = self.values.get(label_values)
+        if state is None:
+            state = self.values[label_values] = [0] * len(self.buckets) + [0.0]
+        for i, bound in enumerate(self.buckets):
+            if value <= bound:
+                state[i] += 1
+                break
+        state[-1] += value
+
+    def render(self):
+        lines = [f"# HELP {self.name} {self.help_text}", f"# TYPE {self.name} {self.kind}"]
+        for label_values, state in sorted(self.values.items()):
+            cumulative = 0
+            for bound, count in zip(self.buckets, state):
+                cumulative += count
+                labels = _format_labels(self.labels, label_values, [("le", _format_value(bound))])
+                lines.append(f"{self.name}_bucket{labels} {cumulative}")
+            labels = _format_labels(self.labels, label_values)
+            lines.append(f"{self.name}_sum{labels} {_format_value(state[-1])}")
+            lines.append(f"{self.name}_count{labels} {cumulative}")
+        return lines
+
+
+def counter(name, help_text, labels=(), callback=None):
+    return Counter(name, help_text, labels, callback)
+
+
+def gauge(name, help_text, labels=(), callback=None):
+    return Gauge(name, help_text, labels, callback)
+
+
+def histogram(name, help_text, labels=(), buckets=LATENCY_BUCKETS):
+    return Histogram(name, help_text, labels, buckets)
+
+
+def render():
+    lines = []
+    for metric in REGISTRY:
+        lines.extend(metric.render())
+    return "\n".join(lines) + "\n"
+
+
+# HTTP ========================================================================
+
+
+async def handle_http(reader, writer):
+    try:
+        request_line = (await reader.readline()).decode(errors="replace").split()
+        while (await reader.readline()).strip():
+            pass
+
+        if len(request_line) >= 2 and request_line[0] == "GET" and request_line[1] == "/metrics":
+            status, body = "200 OK", render().encode()
+        else:
+            status, body = "404 Not Found", b""
+        writer.write(f"HTTP/1.1 {status}\r\n"
+                     f"Content-Type: text/plain; version=0.0.4\r\n"
+                     f"Content-Length: {len(body)}\r\n"
+                     f"Connection: close\r\n\r\n".encode() + body)
+        await writer.drain()
+    except (ConnectionError, asyncio.IncompleteReadError):
+        pass
+    finally:
+        writer.close()
+
+
+async def serve_http(host, port):
+    """Serves /metrics until cancelled."""
+    server = await asyncio.start_server(handle_http, host, port)
+    logging.info(f"[metrics] serving on http://{host}:{port}/metrics")
+    async with server:
+        await server.serve_forever()
@@ -0,0 +1,299 @@
+"""
+Compact columnar archive of IoT-LAB monitoring data.
+
+export converts the .oml files of an experiment (~/.iot-lab/<exp>/<type>/<node>.oml)
+into one archive file; query reads back only the columns, nodes and time range
+it is asked for, without parsing text.
+
+File layout:
+  MAGIC
+  blocks          one per (type, node) and BLOCK_ROWS rows, each column compressed on its own
+  index           zlib-compressed JSON: per block its type, node, first/last timestamp, rows
+                  and per column (offset, length, encoding)
+  index offset    8 bytes, little endian
+  MAGIC
+
+Columns are typed after the OML schema line: "timestamp" (µs since the epoch, from
+timestamp_s/timestamp_us) and integer columns (channel, rssi, ...) are delta
+encoded as zigzag varints, double columns (power, voltage, current) are stored
+as float64 with their bytes shuffled (all first bytes, then all second bytes, ...),
+so zlib finds the repeated exponents. Both are lossless.
+
+Usage:
+  python3 oml_archive.py export [EXP_ID ...] [-o DIR]
+  python3 oml_archive.py query ARCHIVE [--type consumption] [--node m3_1] [--columns power,voltage]
+                               [--start TS] [--end TS]
+"""
+import argparse
+import array
+import bisect
+import glob
+import json
+import os
+import struct
+import subprocess
+import sys
+import zlib
+
+
+# CONFIG ======================================================================
+
+HOME = os.environ.get("HOME")
+IOTLAB_DIR = HOME + "/.iot-lab"
+ARCHIVE_DIR = HOME + "/.gin206/archive"
+MONITORING_TYPES = ("consumption", "radio")
+BLOCK_ROWS = 1 << 16
+MAGIC = b"GINARCH1"
+
+# used when an .oml file has no schema line (columns after timestamp_s/timestamp_us)
+DEFAULT_SCHEMAS = {
+    "consumption": [("power", "double"), ("voltage", "double"), ("current", "double")],
+    "radio": [("channel", "uint32"), ("rssi", "int32")],
+}
+
+
+# ENCODING ====================================================================
+
+
+def encode_varints(values):
+    """Zigzag varints of the differences between consecutive integers."""
+    out = bytearray()
+    previous = 0
+    for value in values:
+        delta = value - previous
+        previous = value
+        n = delta << 1 if delta >= 0 else (-delta << 1) - 1
+        while n >= 0x80:
+            out.append(n & 0x7f | 0x80)
+            n >>= 7
+        out.append(n)
+    return bytes(out)
+
+
+def decode_varints(data):
+    values = []
+    previous = 0
+    n = shift = 0
+    for byte in data:
+        n |= (byte & 0x7f) << shift
+        shift += 7
+        if not byte & 0x80:
+            previous += n >> 1 if not n & 1 else -((n + 1) >> 1)
+            values.append(previous)
+            n = shift = 0
+    return values
+
+
+def encode_doubles(values):
+    data = array.array("d", values)
+    if sys.byteorder != "little":
+        data.byteswap()
+    data = data.tobytes()
+    return b"".join(data[i::8] for i in range(8))
+
+
+def decode_doubles(data):
+    rows = len(data) // 8
+    unshuffled = bytearray(len(data))
+    for i in range(8):
+        unshuffled[i::8] = data[i * rows:(i + 1) * rows]
+    values = array.array("d", bytes(unshuffled))
+    if sys.byteorder != "little":
+        values.byteswap()
+    return values.tolist()
+
+
+ENCODINGS = {
+    "varint": (encode_varints, decode_varints),
+    "double": (encode_doubles, decode_doubles),
+}
+
+
+def column_encoding(oml_type):
+    return "double" if oml_type in ("double", "float") else "varint"
+
+
+# OML =========================================================================
+
+
+def read_oml(path, monitoring_type):
+    """
+    Parses an .oml file into typed columns.
+    :return: {"timestamp": [µs, ...], "<column>": [...]}, empty lists for an empty file
+    """
+    schema = None
+    with open(path, errors="replace") as f:
+        for line in f:
+            if line == "\n":
+                break
+            if line.startswith("schema:") and "_experiment_metadata" not in line:
+                # schema: 1 <name> timestamp_s:uint32 timestamp_us:uint32 <column>:<type> ...
+                schema = [tuple(field.split(":", 1)) for field in line.split()[3:]][2:]
+        schema = schema or DEFAULT_SCHEMAS[monitoring_type]
+        columns = {"timestamp": []}
+        columns.update((name, []) for name, _ in schema)
+        parsers = [(columns[name], float if column_encoding(oml_type) == "double" else int)
+                   for name, oml_type in schema]
+        for line in f:
+            # <time since start> <schema id> <sequence> <timestamp_s> <timestamp_us> <columns ...>
+            fields = line.split()
+            if len(fields) != 5 + len(parsers):
+                continue  # partially written last line
+            try:
+                values = [parse(field) for (_, parse), field in zip(parsers, fields[5:])]
+                timestamp = int(fields[3]) * 1000000 + int(fields[4])
+            except ValueError:
+                continue
+            columns["timestamp"].append(timestamp)
+            for (column, _), value in zip(parsers, values):
+                column.append(value)
+    return columns, dict(schema)
+
+
+# ARCHIVE =====================================================================
+
+
+def write_archive(path, streams):
+    """
+    :param streams: list of (monitoring type, node, columns, {column: oml type})
+    """
+    index = []
+    tmp_path = path + ".tmp"
+    with open(tmp_path, "wb") as f:
+        f.write(MAGIC)
+        for monitoring_type, node, columns, types in streams:
+            order = sorted(range(len(columns["timestamp"])), key=columns["timestamp"].__getitem__)
+            for start in range(0, len(order), BLOCK_ROWS):
+                rows = order[start:start + BLOCK_ROWS]
+                block = {"type": monitoring_type, "node": node, "rows": len(rows),
+                         "first": columns["timestamp"][rows[0]], "last": columns["timestamp"][rows[-1]],
+                         "columns": {}}
+                for name, values in columns.items():
+                    encoding = "varint" if name == "timestamp" else column_encoding(types[name])
+                    data = zlib.compress(ENCODINGS[encoding][0]([values[row] for row in rows]), 9)
+                    block["columns"][name] = [f.tell(), len(data), encoding]
+                    f.write(data)
+                index.append(block)
+        index_offset = f.tell()
+        f.write(zlib.compress(json.dumps(index, separators=(",", ":")).encode(), 9))
+        f.write(struct.pack("<Q", index_offset))
+        f.write(MAGIC)
+    os.replace(tmp_path, path)
+    return index
+
+
+class ArchiveReader:
+
+    def __init__(self, path):
+        self.file = open(path, "rb")
+        self.file.seek(-8 - len(MAGIC), os.SEEK_END)
+        trailer = self.file.read()
+        if trailer[8:] != MAGIC:
+            raise ValueError(f"{path} is not a monitoring archive")
+        index_offset, = struct.unpack("<Q", trailer[:8])
+        index_end = self.file.seek(0, os.SEEK_END) - len(trailer)
+        self.file.seek(index_offset)
+        self.index = json.loads(zlib.decompress(self.file.read(index_end - index_offset)))
+
+    def nodes(self, monitoring_type=None):
+        return sorted({block["node"] for block in self.index
+                       if monitoring_type is None or block["type"] == monitoring_type})
+
+    def read(self, monitoring_type, nodes=None, columns=None, start=None, end=None):
+        """
+        Reads the rows of the given type, nodes and time range [start, end] (µs since the epoch),
+        decompressing only the blocks in range and the requested columns.
+        :return: {"node": [...], "timestamp": [...], "<column>": [...]}
+        """
+        result = {"node": [], "timestamp": []}
+        for block in self.index:
+            if (block["type"] != monitoring_type or (nodes is not None and block["node"] not in nodes)
+                    or (start is not None and block["last"] < start) or (end is not None and block["first"] > end)):
+                continue
+            wanted = [name for name in block["columns"] if name != "timestamp" and (columns is None or name in columns)]
+            timestamps = self._column(block, "timestamp")
+            lo = 0 if start is None else bisect.bisect_left(timestamps, start)
+            hi = len(timestamps) if end is None else bisect.bisect_right(timestamps, end)
+            result["node"].extend([block["node"]] * (hi - lo))
+            result["timestamp"].extend(timestamps[lo:hi])
+            for name in wanted:
+                result.setdefault(name, []).extend(self._column(block, name)[lo:hi])
+        return result
+
+    def _column(self, block, name):
+        offset, length, encoding = block["columns"][name]
+        self.file.seek(offset)
+        return ENCODINGS[encoding][1](zlib.decompress(self.file.read(length)))
+
+    def close(self):
+        self.file.close()
+
+
+# COMMANDS ====================================================================
+
+
+def running_experiment():
+    try:
+        return json.loads(subprocess.getoutput("iotlab-experiment get -p"))["id"]
+    except (ValueError, KeyError):
+        print("Error: give an experiment id or make sure exactly one experiment is running")
+        raise
+
+
+def export(exp_id, out_dir):
+    streams = []
+    text_bytes = 0
+    for monitoring_type in MONITORING_TYPES:
+        for path in sorted(glob.glob(os.path.join(IOTLAB_DIR, str(exp_id), monitoring_type, "*.oml"))):
+            columns, types = read_oml(path, monitoring_type)
+            text_bytes += os.path.getsize(path)
+            if columns["timestamp"]:
+                node = os.path.basename(path)[:-len(".oml")]
+                streams.append((monitoring_type, node, columns, types))
+    if not streams:
+        print(f"Error: no monitoring data under {IOTLAB_DIR}/{exp_id}")
+        return None
+    os.makedirs(out_dir, exist_ok=True)
+    path = os.path.join(out_dir, f"{exp_id}.gina")
+    index = write_archive(path, streams)
+    print(f"{path}: {sum(block['rows'] for block in index)} rows from {len(streams)} files, "
+          f"{text_bytes} -> {os.path.getsize(path)} bytes")
+    return path
+
+
+def query(args):
+    reader = ArchiveReader(args.archive)
+    columns = args.columns.split(",") if args.columns else None
+    nodes = args.node or None
+    result = reader.read(args.type, nodes, columns, args.start, args.end)
+    names = list(result)
+    print(",".join(names))
+    for row in zip(*(result[name] for name in names)):
+        print(",".join(str(value) for value in row))
+    reader.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    commands = parser.add_subparsers(dest="command", required=True)
+    export_parser = commands.add_parser("export", help="archive the .oml files of experiments")
+    export_parser.add_argument("exp_ids", nargs="*", help="default: the running experiment")
+    export_parser.add_argument("-o", "--out", default=ARCHIVE_DIR, help="archive directory")
+    query_parser = commands.add_parser("query", help="print archived rows as CSV")
+    query_parser.add_argument("archive")
+    query_parser.add_argument("--type", choices=MONITORING_TYPES, default="consumption")
+    query_parser.add_argument("--node", action="append", help="repeat for several nodes, default: all")
+    query_parser.add_argument("--columns", help="comma-separated, default: all")
+    query_parser.add_argument("--start", type=int, help="first timestamp, µs since the epoch")
+    query_parser.add_argument("--end", type=int, help="last timestamp, µs since the epoch")
+    args = parser.parse_args()
+
+    if args.command == "export":
+        for exp_id in args.exp_ids or [running_experiment()]:
+            export(exp_id, args.out)
+    else:
+        query(args)
+
+
+if __name__ == "__main__":
+    main()
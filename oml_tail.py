@@ -0,0 +1,84 @@
+"""
+Incremental reading of IoT-LAB .oml monitoring files.
+
+OmlTailer keeps a byte offset per file and only reads what was appended since
+the previous call, so the cost of a poll follows the new data, not the file
+size. A partially written last line is left for the next call. Offsets are
+persisted with commit(), together with the file's inode to notice a file that
+was replaced, so a restarted forwarder continues where it stopped. Threads may
+read different files through one OmlTailer and commit them independently.
+"""
+import json
+import logging
+import os
+import threading
+
+
+# Upper bound on the bytes read from one file per call, to bound memory when
+# catching up with a long experiment
+MAX_READ_BYTES = 16 << 20
+
+
+class OmlTailer:
+
+    def __init__(self, state_path):
+        self.state_path = state_path
+        # path -> {"inode": inode, "offset": bytes consumed, header included}
+        try:
+            with open(state_path) as f:
+                self.files = json.load(f)
+        except (OSError, ValueError):
+            self.files = {}
+        # what the state file holds: commit(paths) only moves the offsets of paths
+        self.committed = {path: dict(state) for path, state in self.files.items()}
+        self.lock = threading.Lock()
+
+    def read(self, path):
+        """
+        Returns the datapoint lines appended to path since the last call.
+        :param path: .oml file, may not exist yet
+        :return: list of complete lines, without the OML header
+        """
+        try:
+            stat = os.stat(path)
+        except FileNotFoundError:
+            return []
+        state = self.files.setdefault(path, {"inode": stat.st_ino, "offset": 0})
+        if state["inode"] != stat.st_ino or stat.st_size < state["offset"]:
+            logging.info(f"{path} was replaced, reading it from the start")
+            state.update(inode=stat.st_ino, offset=0)
+        if stat.st_size == state["offset"]:
+            return []
+
+        with open(path, "rb") as f:
+            f.seek(state["offset"])
+            data = f.read(min(stat.st_size - state["offset"], MAX_READ_BYTES))
+
+        start = 0
+        if state["offset"] == 0:
+            # the header ends with an empty line
+            header_end = data.find(b"\n\n")
+            if header_end < 0:
+                return []
+            start = header_end + 2
+        end = data.rfind(b"\n") + 1
+        if end <= start:
+            state["offset"] += start
+            return []
+
+        state["offset"] += end
+        return [line for line in data[start:end].decode(errors="replace").splitlines() if line]
+
+    def commit(self, paths=None):
+        """
+        Persists the offsets; call it once the lines read so far are stored safely.
+        :param paths: only persist the offsets of these files, default all
+        """
+        with self.lock:
+            for path in list(self.files) if paths is None else paths:
+                if path in self.files:
+                    self.committed[path] = dict(self.files[path])
+            os.makedirs(os.path.dirname(self.state_path) or ".", exist_ok=True)
+            with open(self.state_path + ".tmp", "w") as f:
+                json.dump(self.committed, f)
+            os.replace(self.state_path + ".tmp", self.state_path)
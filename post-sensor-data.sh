@@ -1,19 +1,29 @@
 # config
 sensor_server=$SENSOR_SERVER;
 device_token="${DEVICE_TOKEN:-MONITOKEN}"
+# read through client.py's cache when it runs, e.g. GATEWAY_CACHE=http://127.0.0.1:8086
+gateway_cache=$GATEWAY_CACHE;
 
 # sensor_server="2001:660:4403:481::b870";
-thingsboard_telemetry="http://mauro.rezel.net:8080/api/v1/$device_token/telemetry"
+thingsboard_telemetry="${THINGSBOARD_URL:-http://mauro.rezel.net:8080}/api/v1/$device_token/telemetry"
 light_key="light";
 temperature_key="temperature";
 rain_key="rain";
 
+read_sensor() {
+  if [ -n "$gateway_cache" ]; then
+    curl -s "$gateway_cache/$sensor_server/$1";
+  else
+    aiocoap-client coap://[$sensor_server]/$1;
+  fi
+}
+
 while :;
 do
 # insert IPv6 address of sensor CoAP server
-light=$(aiocoap-client coap://[$sensor_server]/my_res/sim_light);
-temperature=$(aiocoap-client coap://[$sensor_server]/my_res/sim_temperature);
-rain=$(aiocoap-client coap://[$sensor_server]/my_res/sim_rain);
+light=$(read_sensor s/l);
+temperature=$(read_sensor s/t);
+rain=$(read_sensor s/r);
 
 curl -X POST -d "{$light_key: $light}" $thingsboard_telemetry --header "Content-Type:application/json";
 curl -X POST -d "{$temperature_key: $temperature}" $thingsboard_telemetry --header "Content-Type:application/json";
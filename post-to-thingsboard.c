@@ -42,6 +42,7 @@
 #include "contiki.h"
 #include "contiki-net.h"
 #include "er-coap-engine.h"
+#include "coap-pipeline.h"
 #include "dev/button-sensor.h"
 
 #define DEBUG 1
@@ -63,7 +64,8 @@
 #define LOCAL_PORT      UIP_HTONS(COAP_DEFAULT_PORT + 1)
 #define REMOTE_PORT     UIP_HTONS(COAP_DEFAULT_PORT) // should be 5683 !
 
-#define TOGGLE_INTERVAL 1
+/* A new sample is produced every SAMPLE_INTERVAL ticks. */
+#define SAMPLE_INTERVAL (CLOCK_SECOND / 8)
 
 PROCESS(er_example_client, "Test posting to Thingsboard");
 AUTOSTART_PROCESSES(&er_example_client);
@@ -77,64 +79,78 @@ static struct etimer et;
 char *service_urls[NUMBER_OF_URLS] =
 { "/api/v1/MYTOKEN/telemetry" };
 
+/* Samples produced, sent and acknowledged so far. */
+static uint16_t samples_produced;
+static uint16_t samples_sent;
+static uint16_t samples_acked;
+static uint16_t samples_lost;
 
-/* This function is will bepassed to COAP_BLOCKING_REQUEST() to handle responses. */
+/* This function is passed to coap_pipeline_post() to handle responses. */
 void
-client_chunk_handler(void *response)
+client_response_handler(void *data, void *response)
 {
   const uint8_t *chunk;
+  int len;
 
-  int len = coap_get_payload(response, &chunk);
+  if(response == NULL) {
+    /* Timed out after all retransmissions, the sample is dropped. */
+    samples_lost++;
+    PRINTF("|timeout (lost %u)\n", samples_lost);
+    return;
+  }
 
-  printf("|%.*s", len, (char *)chunk);
+  samples_acked++;
+  len = coap_get_payload(response, &chunk);
+  PRINTF("|%u acked (%u in flight) %.*s\n", samples_acked, coap_pipeline_in_flight(), len, (char *)chunk);
 }
 
+/* Send pending samples until the window is full. */
+static void
+send_pending_samples(void)
+{
+  static char msg[32];
+  int len;
+
+  while(samples_sent != samples_produced && coap_pipeline_available() > 0) {
+    len = snprintf(msg, sizeof(msg), "{\"iotlab-data\": %u}", samples_sent);
+    if(!coap_pipeline_post(&server_ipaddr, REMOTE_PORT, service_urls[0],
+                           (uint8_t *)msg, len, client_response_handler, NULL)) {
+      /* No transaction available, retry on the next tick. */
+      break;
+    }
+    samples_sent++;
+  }
+}
 
 PROCESS_THREAD(er_example_client, ev, data)
 {
   PROCESS_BEGIN();
 
-  static coap_packet_t request[1];      /* This way the packet can be treated as pointer as usual. */
-
   SERVER_NODE(&server_ipaddr);
 
   /* receives all CoAP messages */
   coap_init_engine();
+  coap_pipeline_init();
+
+  PRINT6ADDR(&server_ipaddr);
+  PRINTF(" : %u, window %u\n", UIP_HTONS(REMOTE_PORT), COAP_PIPELINE_WINDOW);
 
-  etimer_set(&et, TOGGLE_INTERVAL * CLOCK_SECOND);
+  etimer_set(&et, SAMPLE_INTERVAL);
 
   while(1) {
     PROCESS_YIELD();
 
     if(etimer_expired(&et)) {
-      printf("--Toggle timer--\n");
-
-      PRINTF("\n Do a CoAP POST\n");
-      /* prepare request, TID is set by COAP_BLOCKING_REQUEST() */
-      coap_init_message(request, COAP_TYPE_CON, COAP_POST, 0);
-      coap_set_header_uri_path(request, service_urls[0]);
-
-      const char msg[] = "{\"iotlab-data\": 3}";
-
-      coap_set_payload(request, (uint8_t *)msg, sizeof(msg) - 1);
-
-      PRINT6ADDR(&server_ipaddr);
-      PRINTF(" : %u\n", UIP_HTONS(REMOTE_PORT));
-
-      COAP_BLOCKING_REQUEST(&server_ipaddr, REMOTE_PORT, request,
-                            client_chunk_handler);
-
-      /* make a second request
-      PRINTF("\n Second request \n");
-      // set header
-      coap_init_message(request, COAP_TYPE_CON, COAP_POST, 0);
-      // set url
-      coap_set_header_uri_path(request, service_urls[0]);
-      // make request
-      COAP_BLOCKING_REQUEST(&server_ipaddr, REMOTE_PORT, request,
-                            client_chunk_handler);
-      */
-      printf("\n--Done--\n");
+      samples_produced++;
+
+      /*
+       * Responses are handled asynchronously, so samples keep flowing while
+       * earlier requests are still in flight.
+       */
+      send_pending_samples();
+
+      PRINTF("--Tick: produced %u, sent %u, acked %u, lost %u--\n",
+             samples_produced, samples_sent, samples_acked, samples_lost);
 
       etimer_reset(&et);
     }
@@ -45,11 +45,25 @@
 #include "rest-engine.h"
 
 #include "dev/serial-line.h"
+#if ENERGEST_CONF_ON
+#include "sys/energest.h"
+#endif
 
 #include "resources/extern_var.h"
+#include "resources/resource-dispatch.h"
+
+#if DIRECT_TELEMETRY
+#include "direct-telemetry.h"
+#endif
+
+// Enable / disable optimization (make USE_ACCEL_ALARM=0 builds the variant without it)
+#ifndef USE_ACCEL_ALARM
+#define USE_ACCEL_ALARM 1
+#endif
+int use_accel_alarm = USE_ACCEL_ALARM;
 
-// Enable / disable optimization
-int use_accel_alarm = 1;
+// Scripted workload: serial line "accel <milli-g>" fixes the acceleration, "accel auto" releases it
+float forced_accel = -1.0f;
 
 // Sensors data
 int current_light = 256;
@@ -78,26 +92,29 @@ int lights_alarm_status = 0;
 #endif
 
 /*
- * Resources to be activated need to be imported through the extern keyword.
- * The build system automatically compiles the resources in the corresponding sub-directory.
+ * Resources are registered in resources/resource-table.h.
+ * The event resource is triggered from here, so it is imported through the extern keyword.
  */
-extern resource_t
-  res_event,
-
-  // Alarms
-  res_alarm_accel,
-  res_alarm_freezing,
-  res_alarm_lights,
-  res_alarm_traffic,
-
-  // Sensors
-  res_sim_light,
-  res_sim_temperature,
-  res_sim_rain,
-  res_sim_traffic,
-  res_sim_accel;
+extern resource_t res_event;
 
 extern char* res_serial_data;
+
+#if ENERGEST_CONF_ON
+/* make WITH_ENERGEST=1: the time spent per power state is printed this often */
+#define ENERGEST_PRINT_INTERVAL (10 * CLOCK_SECOND)
+static struct etimer energest_timer;
+
+static void
+energest_print(void)
+{
+  energest_flush();
+  printf("[energest] clock=%lu rtimer_second=%lu cpu=%lu lpm=%lu tx=%lu rx=%lu\n",
+         clock_seconds(), (unsigned long)RTIMER_SECOND,
+         energest_type_time(ENERGEST_TYPE_CPU), energest_type_time(ENERGEST_TYPE_LPM),
+         energest_type_time(ENERGEST_TYPE_TRANSMIT), energest_type_time(ENERGEST_TYPE_LISTEN));
+}
+#endif
+
 PROCESS(er_example_server, "Resource CoAP Server");
 AUTOSTART_PROCESSES(&er_example_server);
 
@@ -124,27 +141,30 @@ PROCESS_THREAD(er_example_server, ev, data)
   /* Initialize the REST engine. */
   rest_init_engine();
 
-  /*
-   * Bind the resources to their Uri-Path.
-   * WARNING: Activating twice only means alternate path, not two instances!
-   * All static variables are the same for each URI path.
-   */
-  // Alarms
-  rest_activate_resource(&res_alarm_accel, "my_res/alarm_accel");
-  rest_activate_resource(&res_alarm_freezing, "my_res/alarm_freezing");
-  rest_activate_resource(&res_alarm_lights, "my_res/alarm_lights");
-  rest_activate_resource(&res_alarm_traffic, "my_res/alarm_traffic");
-  // Sensors
-  rest_activate_resource(&res_sim_light, "my_res/sim_light");
-  rest_activate_resource(&res_sim_temperature, "my_res/sim_temperature");
-  rest_activate_resource(&res_sim_rain, "my_res/sim_rain");
-  rest_activate_resource(&res_sim_traffic, "my_res/sim_traffic");
-  rest_activate_resource(&res_sim_accel, "my_res/sim_accel");
+  /* Bind the resources of resources/resource-table.h to their Uri-Path. */
+  resource_table_activate();
+
+#if DIRECT_TELEMETRY
+  /* Push telemetry straight to ThingsBoard instead of waiting for the gateway. */
+  direct_telemetry_init();
+#endif
+
+#if ENERGEST_CONF_ON
+  etimer_set(&energest_timer, ENERGEST_PRINT_INTERVAL);
+#endif
 
   /* Define application-specific events here. */
   while(1) {
     PROCESS_WAIT_EVENT();
-    if(ev == serial_line_event_message) {
+    if(ev == serial_line_event_message && strncmp((char *)data, "accel ", 6) == 0) {
+      /* Workload of tools/alarm-ab.py */
+      if(strcmp((char *)data + 6, "auto") == 0) {
+        forced_accel = -1.0f;
+      } else {
+        forced_accel = atoi((char *)data + 6) / 1000.0f;
+      }
+      printf("[workload] %s\n", (char *)data);
+    } else if(ev == serial_line_event_message) {
       res_serial_data = (char*)data;
 
       /* Call the event_handler for this application-specific event. */
@@ -153,6 +173,12 @@ PROCESS_THREAD(er_example_server, ev, data)
       /* Also call the separate response example handler. */
       // res_separate.resume();
     }
+#if ENERGEST_CONF_ON
+    else if(ev == PROCESS_EVENT_TIMER && data == &energest_timer) {
+      energest_print();
+      etimer_reset(&energest_timer);
+    }
+#endif
   }                             /* while (1) */
 
   PROCESS_END();
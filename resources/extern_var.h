@@ -1,5 +1,7 @@
 // Toggle the acceleration alarm optimization for evaluation purposes
 extern int use_accel_alarm;
+// Acceleration set by a scripted workload over the serial line, < 0 when simulated
+extern float forced_accel;
 
 // Sensors data
 extern int current_light;
@@ -44,8 +44,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include "rest-engine.h"
+#include "er-coap.h"
 
 #include "extern_var.h"
+#include "sample-format.h"
 #include "res-sim-traffic.h"
 
 static void res_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset);
@@ -57,6 +59,10 @@ static int traffic_alarm_threshold_reached();
 
 static const float TRAFFIC_THRESHOLD = 1.5;
 
+// Status changes so far and when the last one happened, sent along with the status
+static uint16_t changes;
+static clock_time_t changed_at;
+
 PERIODIC_RESOURCE(res_alarm_traffic,
          "title=ALARM-TRAFFIC",
          res_get_handler,
@@ -69,12 +75,23 @@ PERIODIC_RESOURCE(res_alarm_traffic,
 static void
 res_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset)
 {
+  static uint8_t etag; // the packet keeps a pointer until it is serialized
+  const uint8_t *request_etag;
+
   printf("[res-alarm-traffic] res_get_handler called (status=%d)\n", traffic_alarm_status);
 
-  REST.set_header_content_type(response, REST.type.TEXT_PLAIN);
-  snprintf((char *)buffer, REST_MAX_CHUNK_SIZE, "%d", traffic_alarm_status);
-  REST.set_response_payload(response, (uint8_t *)buffer, strlen((char *)buffer));
+  // The change count is the ETag: a client holding the current status gets 2.03 without payload
+  etag = (uint8_t)changes;
   REST.set_header_max_age(response, MAX_AGE);
+  REST.set_header_etag(response, &etag, 1);
+  if (coap_get_header_etag(request, &request_etag) == 1 && *request_etag == etag) {
+    REST.set_response_status(response, REST.status.NOT_MODIFIED);
+    return;
+  }
+
+  snprintf((char *)buffer, REST_MAX_CHUNK_SIZE, "%d", traffic_alarm_status);
+  // JSON with change count and time unless text/plain is asked for: notifications carry no Accept
+  sample_set_payload(response, (char *)buffer, sample_wants_json(request, 1), changes, changed_at);
 
   /* The REST.subscription_handler() will be called for observable resources by the REST framework. */
 }
@@ -96,6 +113,8 @@ res_periodic_handler()
   int new_alarm_status = traffic_alarm_threshold_reached();
   if (new_alarm_status != traffic_alarm_status) {
     traffic_alarm_status = new_alarm_status;
+    changes++;
+    changed_at = clock_time();
 
     printf("[res-alarm-traffic] status changed to %d, notifying subscribers\n", traffic_alarm_status);
     /* Notify the registered observers which will trigger the res_get_handler to create the response. */
@@ -0,0 +1,63 @@
+/**
+ * \file
+ *      All simulated sensors in one SenML pack, so a poll of every sensor
+ *      is a single exchange:
+ *      [{"bn":"<node>:","bt":<seconds>,"n":"l","v":..},{"n":"t","v":..},{"n":"r","v":..},..]
+ *      The names are the sensors' short paths (s/l, s/t, ...). bt is left out
+ *      while the node's time is not set, the samples are then "now".
+ *      In CBOR (Accept: application/senml+cbor) the pack fits one block.
+ */
+
+#include <string.h>
+#include "rest-engine.h"
+
+#include "res-sim-accel.h"
+#include "res-sim-light.h"
+#include "res-sim-rain.h"
+#include "res-sim-temperature.h"
+#include "res-sim-traffic.h"
+#include "res-time.h"
+#include "senml.h"
+#include "sample-format.h"
+
+static void sensors_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset);
+
+static const int MAX_AGE = 1; // in seconds, like the single sensors
+
+// The pack being served; later blocks of a Block2 transfer are cut from it
+static uint8_t pack[128];
+static uint16_t pack_len;
+static uint8_t pack_format;
+static uint8_t pack_etag; // the packet keeps a pointer until it is serialized
+
+RESOURCE(res_sensors,
+         "title=SENSORS;ct=110",
+         sensors_get_handler,
+         NULL,
+         NULL,
+         NULL);
+
+static void
+sensors_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset)
+{
+  struct senml_pack senml;
+  unsigned long seconds = 0;
+  uint16_t ms;
+
+  if(*offset == 0) {
+    if(node_time_is_set()) {
+      get_node_time(&seconds, &ms);
+    }
+    pack_format = sample_pack_format(request);
+    senml_begin(&senml, pack, sizeof(pack), pack_format, sample_base_name(), seconds, NULL);
+    senml_add(&senml, "l", NULL, get_light_sensor_value(), 0, 0);
+    senml_add(&senml, "t", NULL, get_temperature_sensor_value(), 0, 0);
+    senml_add(&senml, "r", NULL, (int32_t)(get_rain_sensor_value() * 100 + 0.5f), 2, 0);
+    senml_add(&senml, "tr", NULL, (int32_t)(get_traffic_sensor_value() * 10 + 0.5f), 1, 0);
+    senml_add(&senml, "ac", NULL, (int32_t)(get_accel_sensor_value() * 10 + 0.5f), 1, 0);
+    pack_len = senml_end(&senml);
+    pack_etag++;
+  }
+  sample_set_pack(response, buffer, preferred_size, offset, pack, pack_len, pack_format, &pack_etag);
+  REST.set_header_max_age(response, MAX_AGE);
+}
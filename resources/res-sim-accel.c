@@ -42,6 +42,8 @@
 #include "rest-engine.h"
 
 #include "extern_var.h"
+#include "sim-trace.h"
+#include "sample-format.h"
 #include "res-sim-accel.h"
 
 static void sim_accel_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset);
@@ -56,6 +58,9 @@ static const int PROB_DECREASE = 50; // in percent
 static const int PROB_INCREASE = 10;
 static const int MIN_ACCEL = 0.0;
 static const int MAX_ACCEL = 2.0;
+static const int MAX_AGE = 1; // in seconds, lets the gateway cache one reading per poll period
+
+SIM_TRACE(accel_trace, 5)
 
 
 RESOURCE(res_sim_accel,
@@ -68,28 +73,39 @@ RESOURCE(res_sim_accel,
 static void
 sim_accel_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset)
 {
+  static uint16_t seq;
   float accel_sensor_value = get_accel_sensor_value();
-  REST.set_header_content_type(response, REST.type.TEXT_PLAIN);
   snprintf((char*)buffer, REST_MAX_CHUNK_SIZE, "%f", accel_sensor_value);
-  REST.set_response_payload(response, (int *)buffer, strlen((char *)buffer));
+  // with Accept: application/json, also the sequence number and time of the sample
+  sample_set_payload(response, (char *)buffer, sample_wants_json(request, 0), ++seq, clock_time());
+  REST.set_header_max_age(response, MAX_AGE);
 }
 
 
 float
 get_accel_sensor_value()
 {
-  // randomly change the value, with a preference of staying in the same state
-  int random = 0;
-  random = rand() % 100;
+  int steps = SIM_TRACE_STEPS(accel_trace);
 
-  // increase or decrease acceleration exponentially, but don't exceed bounds
-  if (in_decrease_range(random)) {
-    if (min_not_reached()) {
-      decrease();
-    }
-  } else if (in_increase_range(random)) {
-    if (max_not_reached()) {
-      increase();
+  // a scripted workload (serial line "accel <milli-g>") overrides the simulation
+  if (forced_accel >= 0) {
+    current_accel = forced_accel;
+    return current_accel;
+  }
+
+  // randomly change the value, with a preference of staying in the same state
+  while (steps-- > 0) {
+    int random = SIM_TRACE_RAND(accel_trace) % 100;
+
+    // increase or decrease acceleration exponentially, but don't exceed bounds
+    if (in_decrease_range(random)) {
+      if (min_not_reached()) {
+        decrease();
+      }
+    } else if (in_increase_range(random)) {
+      if (max_not_reached()) {
+        increase();
+      }
     }
   }
   return current_accel;
@@ -42,9 +42,11 @@
 #include "rest-engine.h"
 
 #include "extern_var.h"
+#include "sim-trace.h"
+#include "sample-format.h"
+#include "res-sim-rain.h"
 
 static void sim_rain_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset);
-float get_rain_sensor_value();
 static int in_decrease_range(int random);
 static int in_increase_range(int random);
 static int min_not_reached();
@@ -56,6 +58,9 @@ static const int PROB_DECREASE = 30; // in percent
 static const int PROB_INCREASE = 20;
 static const float MIN_RAIN = 0.0;
 static const float MAX_RAIN = 1.0;
+static const int MAX_AGE = 1; // in seconds, lets the gateway cache one reading per poll period
+
+SIM_TRACE(rain_trace, 3)
 
 RESOURCE(res_sim_rain,
          "title=SIM-RAIN",
@@ -67,27 +72,32 @@ RESOURCE(res_sim_rain,
 static void
 sim_rain_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset)
 {
+  static uint16_t seq;
   float rain_sensor_value = get_rain_sensor_value();
-  REST.set_header_content_type(response, REST.type.TEXT_PLAIN);
   snprintf((char*)buffer, REST_MAX_CHUNK_SIZE, "%f", rain_sensor_value);
-  REST.set_response_payload(response, (int *)buffer, strlen((char *)buffer));
+  // with Accept: application/json, also the sequence number and time of the sample
+  sample_set_payload(response, (char *)buffer, sample_wants_json(request, 0), ++seq, clock_time());
+  REST.set_header_max_age(response, MAX_AGE);
 }
 
 float
 get_rain_sensor_value()
 {
-  // randomly change the value, with a preference of staying in the same state
-  int random = 0;
-  random = rand() % 100;
+  int steps = SIM_TRACE_STEPS(rain_trace);
 
-  // increase or decrease rain exponentially, but don't exceed bounds
-  if (in_decrease_range(random)) {
-    if (min_not_reached()) {
-      decrease();
-    }
-  } else if (in_increase_range(random)) {
-    if (max_not_reached()) {
-      increase();
+  // randomly change the value, with a preference of staying in the same state
+  while (steps-- > 0) {
+    int random = SIM_TRACE_RAND(rain_trace) % 100;
+
+    // increase or decrease rain exponentially, but don't exceed bounds
+    if (in_decrease_range(random)) {
+      if (min_not_reached()) {
+        decrease();
+      }
+    } else if (in_increase_range(random)) {
+      if (max_not_reached()) {
+        increase();
+      }
     }
   }
   return current_rain;
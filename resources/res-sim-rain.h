@@ -0,0 +1 @@
+float get_rain_sensor_value();
\ No newline at end of file
@@ -42,19 +42,25 @@
 #include "rest-engine.h"
 
 #include "extern_var.h"
+#include "sim-trace.h"
+#include "sample-format.h"
 #include "res-sim-temperature.h"
 
 static void sim_temperature_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset);
 static int in_decrease_range(int random);
 static int in_increase_range(int random);
-static int min_not_reached();
-static int max_not_reached();
-static void decrease();
-static void increase();
+static int min_not_reached(int temperature);
+static int max_not_reached(int temperature);
+static void decrease(int *temperature);
+static void increase(int *temperature);
+static int step(int *temperature, int random);
 
 static const int PROB_CHANGE_STATE = 50; // in percent
 static const int MIN_TEMP = -5;
 static const int MAX_TEMP = 10;
+static const int MAX_AGE = 1; // in seconds, lets the gateway cache one reading per poll period
+
+SIM_TRACE(temperature_trace, 2)
 
 RESOURCE(res_sim_temperature,
          "title=SIM-TEMPERATURE",
@@ -66,30 +72,46 @@ RESOURCE(res_sim_temperature,
 static void
 sim_temperature_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset)
 {
+  static uint16_t seq;
   int temperature_sensor_value = get_temperature_sensor_value();
-  REST.set_header_content_type(response, REST.type.TEXT_PLAIN);
   snprintf((char*)buffer, REST_MAX_CHUNK_SIZE, "%d", temperature_sensor_value);
-  REST.set_response_payload(response, (int *)buffer, strlen((char *)buffer));
+  // with Accept: application/json, also the sequence number and time of the sample
+  sample_set_payload(response, (char *)buffer, sample_wants_json(request, 0), ++seq, clock_time());
+  REST.set_header_max_age(response, MAX_AGE);
 }
 
 int
 get_temperature_sensor_value()
+{
+  int steps = SIM_TRACE_STEPS(temperature_trace);
+
+  while (steps-- > 0) {
+    step(&current_temperature, SIM_TRACE_RAND(temperature_trace) % 100);
+  }
+  return current_temperature;
+}
+
+int
+step_temperature_sensor_value(int *temperature)
 {
   // randomly change the value, with a preference of staying in the same state
-  int random = 0;
-  random = rand() % 100;
+  return step(temperature, rand() % 100);
+}
 
+static int
+step(int *temperature, int random)
+{
   // increase or decrease temperature exponentially, but don't exceed bounds
   if (in_decrease_range(random)) {
-    if (min_not_reached()) {
-      decrease();
+    if (min_not_reached(*temperature)) {
+      decrease(temperature);
     }
   } else if (in_increase_range(random)) {
-    if (max_not_reached()) {
-      increase();
+    if (max_not_reached(*temperature)) {
+      increase(temperature);
     }
   }
-  return current_temperature;
+  return *temperature;
 }
 
 static int
@@ -103,22 +125,21 @@ in_increase_range(int random) {
 }
 
 static int
-min_not_reached() {
-  return current_temperature > MIN_TEMP;
+min_not_reached(int temperature) {
+  return temperature > MIN_TEMP;
 }
 
 static int
-max_not_reached() {
-  return current_temperature < MAX_TEMP;
+max_not_reached(int temperature) {
+  return temperature < MAX_TEMP;
 }
 
 static void
-decrease() {
-  current_temperature = current_temperature - 1;
+decrease(int *temperature) {
+  *temperature = *temperature - 1;
 }
 
 static void
-increase() {
-  current_temperature = current_temperature + 1;
+increase(int *temperature) {
+  *temperature = *temperature + 1;
 }
-
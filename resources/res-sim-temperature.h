@@ -1 +1,3 @@
-int get_temperature_sensor_value();
\ No newline at end of file
+int get_temperature_sensor_value();
+// Advance the simulation of one temperature sensor state
+int step_temperature_sensor_value(int *temperature);
\ No newline at end of file
@@ -42,6 +42,8 @@
 #include "rest-engine.h"
 
 #include "extern_var.h"
+#include "sim-trace.h"
+#include "sample-format.h"
 #include "res-sim-traffic.h"
 
 static void sim_traffic_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset);
@@ -55,6 +57,9 @@ static void increase();
 static const int PROB_CHANGE_STATE = 80; // in percent
 static const int MIN_TRAFFIC = 1.0;
 static const int MAX_TRAFFIC = 2.0;
+static const int MAX_AGE = 1; // in seconds, lets the gateway cache one reading per poll period
+
+SIM_TRACE(traffic_trace, 4)
 
 RESOURCE(res_sim_traffic,
          "title=SIM-TRAFFIC",
@@ -66,28 +71,33 @@ RESOURCE(res_sim_traffic,
 static void
 sim_traffic_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset)
 {
+  static uint16_t seq;
   float traffic_sensor_value = get_traffic_sensor_value();
-  REST.set_header_content_type(response, REST.type.TEXT_PLAIN);
   snprintf((char*)buffer, REST_MAX_CHUNK_SIZE, "%f", traffic_sensor_value);
-  REST.set_response_payload(response, (int *)buffer, strlen((char *)buffer));
+  // with Accept: application/json, also the sequence number and time of the sample
+  sample_set_payload(response, (char *)buffer, sample_wants_json(request, 0), ++seq, clock_time());
+  REST.set_header_max_age(response, MAX_AGE);
 }
 
 
 float
 get_traffic_sensor_value()
 {
-  // randomly change the value, with a preference of staying in the same state
-  int random = 0;
-  random = rand() % 100;
+  int steps = SIM_TRACE_STEPS(traffic_trace);
 
-  // increase or decrease traffic exponentially, but don't exceed bounds
-  if (in_decrease_range(random)) {
-    if (min_not_reached()) {
-      decrease();
-    }
-  } else if (in_increase_range(random)) {
-    if (max_not_reached()) {
-      increase();
+  // randomly change the value, with a preference of staying in the same state
+  while (steps-- > 0) {
+    int random = SIM_TRACE_RAND(traffic_trace) % 100;
+
+    // increase or decrease traffic exponentially, but don't exceed bounds
+    if (in_decrease_range(random)) {
+      if (min_not_reached()) {
+        decrease();
+      }
+    } else if (in_increase_range(random)) {
+      if (max_not_reached()) {
+        increase();
+      }
     }
   }
   return current_traffic;
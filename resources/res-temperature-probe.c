@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2013, Institute for Pervasive Computing, ETH Zurich
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ */
+
+
+/**
+ * \file
+ *      Multiple simulated temperature probes behind one parameterized resource.
+ *      my_res/temperature/<n> serves probe n; each probe keeps its own state,
+ *      allocated from a MEMB pool on first access and released with DELETE.
+ *      The bare my_res/temperature serves the probes in use as one SenML pack
+ *      (base unit Cel, one record per probe, named by its index).
+ * \author
+ *      Template: Matthias Kovatsch <kovatsch@inf.ethz.ch>
+ *	Modifications: Mauro Parafati, Karla Friedrichs
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "contiki.h"
+#include "lib/memb.h"
+#include "rest-engine.h"
+
+#include "res-sim-temperature.h"
+#include "res-time.h"
+#include "senml.h"
+#include "sample-format.h"
+
+static void temperature_probe_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset);
+static void temperature_probe_delete_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset);
+static int get_probe_index(void *request);
+static void all_probes_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset);
+
+// Probe indexes accepted in the URI, 0 .. MAX_PROBES-1
+#define MAX_PROBES        16
+// Probes that can hold state at the same time
+#define PROBE_POOL_SIZE   4
+// get_probe_index() of the bare path, which serves all probes in use
+#define ALL_PROBES        -2
+
+static const int INITIAL_TEMP = 3;
+
+struct temperature_probe {
+  int temperature;
+};
+
+MEMB(probes_memb, struct temperature_probe, PROBE_POOL_SIZE);
+
+// Index to instance, so a URI suffix resolves in constant time
+static struct temperature_probe *probes[MAX_PROBES];
+
+// The pack of all probes being served; later blocks of a Block2 transfer are cut from it
+static uint8_t pack[128];
+static uint16_t pack_len;
+static uint8_t pack_format;
+static uint8_t pack_etag; // the packet keeps a pointer until it is serialized
+
+PARENT_RESOURCE(res_temperature_probe,
+         "title=SIM-TEMPERATURE-PROBE",
+         temperature_probe_get_handler,
+         NULL,
+         NULL,
+         temperature_probe_delete_handler);
+
+static void
+temperature_probe_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset)
+{
+  struct temperature_probe *probe;
+  int index = get_probe_index(request);
+
+  if (index == ALL_PROBES) {
+    all_probes_get_handler(request, response, buffer, preferred_size, offset);
+    return;
+  }
+  if (index < 0) {
+    REST.set_response_status(response, REST.status.NOT_FOUND);
+    return;
+  }
+
+  probe = probes[index];
+  if (probe == NULL) {
+    probe = memb_alloc(&probes_memb);
+    if (probe == NULL) {
+      // all probe states are in use
+      REST.set_response_status(response, REST.status.SERVICE_UNAVAILABLE);
+      return;
+    }
+    probe->temperature = INITIAL_TEMP;
+    probes[index] = probe;
+  }
+
+  REST.set_header_content_type(response, REST.type.TEXT_PLAIN);
+  snprintf((char*)buffer, REST_MAX_CHUNK_SIZE, "%d", step_temperature_sensor_value(&probe->temperature));
+  REST.set_response_payload(response, (int *)buffer, strlen((char *)buffer));
+}
+
+static void
+temperature_probe_delete_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset)
+{
+  int index = get_probe_index(request);
+
+  if (index < 0 || probes[index] == NULL) {
+    REST.set_response_status(response, REST.status.NOT_FOUND);
+    return;
+  }
+
+  memb_free(&probes_memb, probes[index]);
+  probes[index] = NULL;
+  REST.set_response_status(response, REST.status.DELETED);
+}
+
+static void
+all_probes_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset)
+{
+  struct senml_pack senml;
+  static char base_name[20];
+  char name[3];
+  unsigned long seconds = 0;
+  uint16_t ms;
+  int i;
+
+  if (*offset == 0) {
+    if (node_time_is_set()) {
+      get_node_time(&seconds, &ms);
+    }
+    snprintf(base_name, sizeof(base_name), "%stemperature/", sample_base_name());
+    pack_format = sample_pack_format(request);
+    senml_begin(&senml, pack, sizeof(pack), pack_format, base_name, seconds, "Cel");
+    for (i = 0; i < MAX_PROBES; i++) {
+      if (probes[i] != NULL) {
+        snprintf(name, sizeof(name), "%d", i);
+        senml_add(&senml, name, NULL, step_temperature_sensor_value(&probes[i]->temperature), 0, 0);
+      }
+    }
+    pack_len = senml_end(&senml);
+    pack_etag++;
+  }
+  sample_set_pack(response, buffer, preferred_size, offset, pack, pack_len, pack_format, &pack_etag);
+}
+
+/*
+ * Returns the probe index from the URI suffix (my_res/temperature/<n>),
+ * ALL_PROBES for the bare path, or -1 if the suffix is invalid or out of range.
+ */
+static int
+get_probe_index(void *request)
+{
+  const char *url = NULL;
+  int url_len = REST.get_url(request, &url);
+  int base_len = strlen(res_temperature_probe.url);
+  int index = 0;
+  int i;
+
+  // parent resources also match the bare path
+  if (url_len == base_len) {
+    return ALL_PROBES;
+  }
+  if (url_len == base_len + 1 || url[base_len] != '/') {
+    return -1;
+  }
+
+  for (i = base_len + 1; i < url_len; i++) {
+    if (url[i] < '0' || url[i] > '9') {
+      return -1;
+    }
+    index = index * 10 + (url[i] - '0');
+    if (index >= MAX_PROBES) {
+      return -1;
+    }
+  }
+  return index;
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2013, Institute for Pervasive Computing, ETH Zurich
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ */
+
+
+/**
+ * \file
+ *      Wall-clock time of the node.
+ *      The motes only count clock_time() since boot; the gateway PUTs the
+ *      current UNIX time ("<seconds>[.<ms>]") every few minutes (see
+ *      timesync.py). Each PUT resets the offset, and the error the previous
+ *      offset had accumulated since the last PUT refines the estimate of the
+ *      clock's drift, so timestamps stay accurate between syncs.
+ * \author
+ *      Template: Matthias Kovatsch <kovatsch@inf.ethz.ch>
+ *	Modifications: Mauro Parafati, Karla Friedrichs
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rest-engine.h"
+
+#include "res-time.h"
+
+/* Syncs closer together than this do not update the drift, their error is mostly delay jitter */
+#define TIME_DRIFT_MIN_INTERVAL (120 * CLOCK_SECOND)
+/* Errors above this (ms) are time changes or retransmitted PUTs: stepped, but not learnt as drift */
+#define TIME_MAX_ERROR_MS 1000
+/* Crystal drift is a few tens of ppm, anything far beyond is a measurement error */
+#define TIME_MAX_DRIFT_PPM 200
+
+static void time_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset);
+static void time_put_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset);
+
+// UNIX time at clock_time() == sync_ticks, i.e. at the last sync
+static unsigned long sync_seconds = 0;
+static uint16_t sync_ms = 0;
+static clock_time_t sync_ticks = 0;
+// How much faster real time runs than clock_time(), in parts per million
+static int32_t drift_ppm = 0;
+static int time_set = 0;
+
+RESOURCE(res_time,
+         "title=TIME",
+         time_get_handler,
+         NULL,
+         time_put_handler,
+         NULL);
+
+static void
+time_get_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset)
+{
+  unsigned long seconds = 0;
+  uint16_t ms = 0;
+
+  if (time_set) {
+    get_node_time(&seconds, &ms);
+  }
+  REST.set_header_content_type(response, REST.type.TEXT_PLAIN);
+  snprintf((char *)buffer, REST_MAX_CHUNK_SIZE, "%lu.%03u", seconds, (unsigned int)ms);
+  REST.set_response_payload(response, (uint8_t *)buffer, strlen((char *)buffer));
+}
+
+static void
+time_put_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset)
+{
+  const uint8_t *payload;
+  char time_str[16];
+  char *end;
+  unsigned long seconds, node_seconds;
+  uint16_t ms = 0, node_ms;
+  clock_time_t now = clock_time();
+  int64_t error_ms;
+  int32_t measured_ppm;
+  int len = REST.get_request_payload(request, &payload);
+
+  if (len <= 0 || len >= sizeof(time_str)) {
+    REST.set_response_status(response, REST.status.BAD_REQUEST);
+    return;
+  }
+  memcpy(time_str, payload, len);
+  time_str[len] = '\0';
+
+  seconds = strtoul(time_str, &end, 10);
+  if (*end == '.' && end[1] >= '0' && end[1] <= '9') {
+    // up to 3 digits of milliseconds
+    for (len = 0, end++; len < 3; len++) {
+      ms = ms * 10 + (*end >= '0' && *end <= '9' ? *end++ - '0' : 0);
+    }
+  }
+  if (*end != '\0') {
+    REST.set_response_status(response, REST.status.BAD_REQUEST);
+    return;
+  }
+
+  if (time_set) {
+    node_time_from_ticks(now, &node_seconds, &node_ms);
+    error_ms = ((int64_t)seconds - (int64_t)node_seconds) * 1000 + ms - node_ms;
+    /* the error accumulated since the last sync is the drift left after the current estimate */
+    if (now - sync_ticks >= TIME_DRIFT_MIN_INTERVAL
+       && error_ms >= -TIME_MAX_ERROR_MS && error_ms <= TIME_MAX_ERROR_MS) {
+      measured_ppm = (int32_t)(error_ms * 1000000 * CLOCK_SECOND / 1000 / (int64_t)(now - sync_ticks));
+      // halfway towards it, the delay jitter of one sync does not undo the previous ones
+      drift_ppm += measured_ppm / 2;
+      if (drift_ppm > TIME_MAX_DRIFT_PPM) {
+        drift_ppm = TIME_MAX_DRIFT_PPM;
+      } else if (drift_ppm < -TIME_MAX_DRIFT_PPM) {
+        drift_ppm = -TIME_MAX_DRIFT_PPM;
+      }
+    }
+    // the error in ms and the new drift estimate, for the gateway's metrics
+    snprintf((char *)buffer, REST_MAX_CHUNK_SIZE, "%ld %ld", (long)error_ms, (long)drift_ppm);
+    REST.set_header_content_type(response, REST.type.TEXT_PLAIN);
+    REST.set_response_payload(response, buffer, strlen((char *)buffer));
+  } else {
+    printf("[res-time] time set to %lu\n", seconds);
+  }
+
+  sync_seconds = seconds;
+  sync_ms = ms;
+  sync_ticks = now;
+  time_set = 1;
+  REST.set_response_status(response, REST.status.CHANGED);
+}
+
+int
+node_time_is_set()
+{
+  return time_set;
+}
+
+void
+get_node_time(unsigned long *seconds, uint16_t *ms)
+{
+  node_time_from_ticks(clock_time(), seconds, ms);
+}
+
+void
+node_time_from_ticks(clock_time_t ticks, unsigned long *seconds, uint16_t *ms)
+{
+  // negative for samples taken before the last sync
+  int64_t elapsed_ms = (int64_t)(long)(ticks - sync_ticks) * 1000 / CLOCK_SECOND;
+  int64_t time_ms = (int64_t)sync_seconds * 1000 + sync_ms + elapsed_ms + elapsed_ms * drift_ppm / 1000000;
+
+  *seconds = (unsigned long)(time_ms / 1000);
+  *ms = (uint16_t)(time_ms % 1000);
+}
@@ -0,0 +1,8 @@
+#include "contiki.h"
+
+// 1 once the wall-clock time has been set through res_time (PUT by timesync.py)
+int node_time_is_set();
+// Current wall-clock time
+void get_node_time(unsigned long *seconds, uint16_t *ms);
+// Wall-clock time of an earlier clock_time() value, corrected for the estimated drift
+void node_time_from_ticks(clock_time_t ticks, unsigned long *seconds, uint16_t *ms);
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2013, Institute for Pervasive Computing, ETH Zurich
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ */
+
+
+/**
+ * \file
+ *      Compile-time resource table with hashed URI dispatch.
+ *      The REST engine matches a request by walking its resource list with a
+ *      string compare per resource. Exact paths from resource-table.h are
+ *      looked up in a hash table instead, so dispatch cost does not grow with
+ *      the number of resources. Aliases (short paths) only live in the hash
+ *      table. Anything else (sub-resources of parent resources,
+ *      .well-known/core) falls back to the engine.
+ * \author
+ *      Template: Matthias Kovatsch <kovatsch@inf.ethz.ch>
+ *	Modifications: Mauro Parafati, Karla Friedrichs
+ */
+
+#include <string.h>
+#include "rest-engine.h"
+#include "er-coap.h"
+
+#include "resource-table.h"
+#include "resource-dispatch.h"
+
+#define DEBUG 0
+#if DEBUG
+#include <stdio.h>
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+// Must be a power of two, at least twice the number of entries
+#define HASH_SLOTS 64
+
+struct resource_entry {
+  resource_t *resource;
+  const char *path;
+};
+
+#define RESOURCE_DECLARE(res, path, max_payload) extern resource_t res;
+#define RESOURCE_IGNORE(res, path, max_payload)
+RESOURCE_TABLE(RESOURCE_DECLARE, RESOURCE_IGNORE)
+
+// Activated entries first, then aliases
+#define RESOURCE_INIT(res, path, max_payload) { &res, path },
+static const struct resource_entry resource_table[] = {
+  RESOURCE_TABLE(RESOURCE_INIT, RESOURCE_IGNORE)
+  RESOURCE_TABLE(RESOURCE_IGNORE, RESOURCE_INIT)
+};
+
+#define RESOURCE_COUNT(res, path, max_payload) + 1
+#define RESOURCE_ENTRIES (0 RESOURCE_TABLE(RESOURCE_COUNT, RESOURCE_IGNORE))
+#define RESOURCE_TABLE_SIZE (sizeof(resource_table) / sizeof(resource_table[0]))
+
+// Index + 1 into resource_table, 0 for an empty slot
+static uint8_t hash_slots[HASH_SLOTS];
+static uint16_t path_lengths[RESOURCE_TABLE_SIZE];
+
+typedef char hash_slots_too_small[(HASH_SLOTS >= 2 * RESOURCE_TABLE_SIZE) ? 1 : -1];
+
+static int dispatch(void *request, void *response, uint8_t *buffer, uint16_t buffer_size, int32_t *offset);
+
+// FNV-1a, folded to the slot count
+static uint8_t
+hash_path(const char *path, int len)
+{
+  uint32_t hash = 2166136261UL;
+  int i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= (uint8_t)path[i];
+    hash *= 16777619UL;
+  }
+  return (uint8_t)((hash ^ (hash >> 16)) & (HASH_SLOTS - 1));
+}
+
+static void
+index_path(uint8_t entry, const char *path, int len)
+{
+  uint8_t slot = hash_path(path, len);
+  int i;
+
+  // linear probing, the table is never more than half full
+  for (i = 0; i < HASH_SLOTS; i++) {
+    if (hash_slots[slot] == 0) {
+      hash_slots[slot] = entry + 1;
+      return;
+    }
+    slot = (slot + 1) & (HASH_SLOTS - 1);
+  }
+}
+
+static const struct resource_entry *
+lookup(const char *url, int url_len)
+{
+  uint8_t slot = hash_path(url, url_len);
+  uint8_t entry;
+  int i;
+
+  for (i = 0; i < HASH_SLOTS; i++) {
+    if (hash_slots[slot] == 0) {
+      return NULL;
+    }
+    entry = hash_slots[slot] - 1;
+    if (path_lengths[entry] == url_len && memcmp(resource_table[entry].path, url, url_len) == 0) {
+      return &resource_table[entry];
+    }
+    slot = (slot + 1) & (HASH_SLOTS - 1);
+  }
+  return NULL;
+}
+
+void
+resource_table_activate()
+{
+  uint8_t i;
+
+  for (i = 0; i < RESOURCE_TABLE_SIZE; i++) {
+    if (i < RESOURCE_ENTRIES) {
+      rest_activate_resource(resource_table[i].resource, (char *)resource_table[i].path);
+    }
+    path_lengths[i] = strlen(resource_table[i].path);
+    index_path(i, resource_table[i].path, path_lengths[i]);
+  }
+
+  // replaces rest_invoke_restful_service(), which stays as the fallback
+  REST.set_service_callback(dispatch);
+}
+
+/*
+ * Same semantics as rest_invoke_restful_service() for an exact match:
+ * call the handler of the request method, then the subscription handler
+ * for observable resources.
+ */
+static int
+dispatch(void *request, void *response, uint8_t *buffer, uint16_t buffer_size, int32_t *offset)
+{
+  const char *url = NULL;
+  int url_len = REST.get_url(request, &url);
+  const struct resource_entry *entry = lookup(url, url_len);
+  resource_t *resource;
+  rest_resource_flags_t method;
+  restful_handler handler = NULL;
+
+  if (entry == NULL) {
+    PRINTF("[resource-dispatch] fallback for /%.*s\n", url_len, url);
+    return rest_invoke_restful_service(request, response, buffer, buffer_size, offset);
+  }
+
+  resource = entry->resource;
+  method = REST.get_method_type(request);
+  if (method & METHOD_GET) {
+    handler = resource->get_handler;
+  } else if (method & METHOD_POST) {
+    handler = resource->post_handler;
+  } else if (method & METHOD_PUT) {
+    handler = resource->put_handler;
+  } else if (method & METHOD_DELETE) {
+    handler = resource->delete_handler;
+  }
+
+  if (handler == NULL) {
+    REST.set_response_status(response, REST.status.METHOD_NOT_ALLOWED);
+    return 0;
+  }
+
+  handler(request, response, buffer, buffer_size, offset);
+
+  if (resource->flags & IS_OBSERVABLE) {
+    /*
+     * Observers are stored with the request path and notified by resource->url,
+     * so register observers of an alias under the activated path.
+     */
+    if (entry - resource_table >= RESOURCE_ENTRIES) {
+      ((coap_packet_t *)request)->uri_path = resource->url;
+      ((coap_packet_t *)request)->uri_path_len = strlen(resource->url);
+    }
+    REST.subscription_handler(resource, request, response);
+  }
+  return 1;
+}
@@ -0,0 +1,2 @@
+// Activate every resource of resource-table.h and install the hashed URI dispatcher
+void resource_table_activate();
@@ -0,0 +1,44 @@
+/*
+ * Resources served by the resource server, bound to their Uri-Path.
+ * Add a line here to register a resource; resource_table_activate() declares,
+ * activates and indexes every entry.
+ *
+ * RESOURCE_ENTRY(resource, path, max_payload) binds the resource to its path.
+ * RESOURCE_ALIAS(resource, path, max_payload) adds a short path served by the same
+ * resource, to keep Uri-Path options small (see tools/frame-budget.py).
+ * max_payload is the longest response payload in bytes, only used by tools/frame-budget.py;
+ * for sensors and alarms it is the timestamped JSON form (see sample-format.h),
+ * for SenML packs one 32-byte block.
+ *
+ * WARNING: Registering a resource twice only means alternate path, not two instances!
+ * Use a parameterized resource (like my_res/temperature/<n>) for several instances.
+ */
+#define RESOURCE_TABLE(RESOURCE_ENTRY, RESOURCE_ALIAS) \
+  /* Alarms */ \
+  RESOURCE_ENTRY(res_alarm_accel, "my_res/alarm_accel", 35) \
+  RESOURCE_ENTRY(res_alarm_freezing, "my_res/alarm_freezing", 35) \
+  RESOURCE_ENTRY(res_alarm_lights, "my_res/alarm_lights", 35) \
+  RESOURCE_ENTRY(res_alarm_traffic, "my_res/alarm_traffic", 35) \
+  RESOURCE_ALIAS(res_alarm_accel, "a/ac", 35) \
+  RESOURCE_ALIAS(res_alarm_freezing, "a/f", 35) \
+  RESOURCE_ALIAS(res_alarm_lights, "a/l", 35) \
+  RESOURCE_ALIAS(res_alarm_traffic, "a/tr", 35) \
+  /* Sensors */ \
+  RESOURCE_ENTRY(res_sim_light, "my_res/sim_light", 40) \
+  RESOURCE_ENTRY(res_sim_temperature, "my_res/sim_temperature", 37) \
+  RESOURCE_ENTRY(res_sim_rain, "my_res/sim_rain", 42) \
+  RESOURCE_ENTRY(res_sim_traffic, "my_res/sim_traffic", 42) \
+  RESOURCE_ENTRY(res_sim_accel, "my_res/sim_accel", 42) \
+  RESOURCE_ALIAS(res_sim_light, "s/l", 40) \
+  RESOURCE_ALIAS(res_sim_temperature, "s/t", 37) \
+  RESOURCE_ALIAS(res_sim_rain, "s/r", 42) \
+  RESOURCE_ALIAS(res_sim_traffic, "s/tr", 42) \
+  RESOURCE_ALIAS(res_sim_accel, "s/ac", 42) \
+  /* All sensors in one SenML pack, in 32-byte blocks (the gateway asks for Block2 SZX 1) */ \
+  RESOURCE_ENTRY(res_sensors, "my_res/sensors", 32) \
+  RESOURCE_ALIAS(res_sensors, "s", 32) \
+  /* Temperature probes, one instance per my_res/temperature/<n>, all of them as a SenML pack */ \
+  RESOURCE_ENTRY(res_temperature_probe, "my_res/temperature", 32) \
+  /* Wall-clock time, kept in sync by the gateway (timesync.py) */ \
+  RESOURCE_ENTRY(res_time, "my_res/time", 17) \
+  RESOURCE_ALIAS(res_time, "tm", 17)
@@ -0,0 +1,107 @@
+/**
+ * \file
+ *      Timestamped sample payloads, see sample-format.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "rest-engine.h"
+
+#include "net/linkaddr.h"
+
+#include "res-time.h"
+#include "senml.h"
+#include "sample-format.h"
+
+int
+sample_wants_json(void *request, int json_by_default)
+{
+  unsigned int accept;
+
+  if(request == NULL || !REST.get_header_accept(request, &accept)) {
+    return json_by_default;
+  }
+  return accept == REST.type.APPLICATION_JSON;
+}
+/*---------------------------------------------------------------------------*/
+void
+sample_set_payload(void *response, char *buffer, int json, uint16_t seq, clock_time_t ticks)
+{
+  char value[16];
+  unsigned long seconds;
+  uint16_t ms;
+  char key = 't';
+
+  if(json) {
+    strncpy(value, buffer, sizeof(value) - 1);
+    value[sizeof(value) - 1] = '\0';
+    if(node_time_is_set()) {
+      node_time_from_ticks(ticks, &seconds, &ms);
+    } else {
+      key = 'u';
+      seconds = ticks / CLOCK_SECOND;
+      ms = (uint16_t)((ticks % CLOCK_SECOND) * 1000 / CLOCK_SECOND);
+    }
+    /* ms printed as seconds and 3 digits, as the M3's printf has no 64-bit integers */
+    if(seconds > 0) {
+      snprintf(buffer, REST_MAX_CHUNK_SIZE, "{\"v\":%s,\"n\":%u,\"%c\":%lu%03u}",
+               value, (unsigned int)seq, key, seconds, (unsigned int)ms);
+    } else {
+      snprintf(buffer, REST_MAX_CHUNK_SIZE, "{\"v\":%s,\"n\":%u,\"%c\":%u}",
+               value, (unsigned int)seq, key, (unsigned int)ms);
+    }
+    REST.set_header_content_type(response, REST.type.APPLICATION_JSON);
+  } else {
+    REST.set_header_content_type(response, REST.type.TEXT_PLAIN);
+  }
+  REST.set_response_payload(response, (uint8_t *)buffer, strlen(buffer));
+}
+/*---------------------------------------------------------------------------*/
+uint8_t
+sample_pack_format(void *request)
+{
+  unsigned int accept;
+
+  if(REST.get_header_accept(request, &accept) && accept == SENML_CBOR_FORMAT) {
+    return SENML_CBOR;
+  }
+  return SENML_JSON;
+}
+/*---------------------------------------------------------------------------*/
+void
+sample_set_pack(void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset,
+                const uint8_t *pack, uint16_t len, uint8_t format, const uint8_t *etag)
+{
+  uint16_t block_len;
+
+  if(*offset >= len) {
+    REST.set_response_status(response, REST.status.BAD_OPTION);
+    return;
+  }
+  block_len = len - *offset;
+  if(block_len > preferred_size) {
+    block_len = preferred_size;
+  }
+  memcpy(buffer, pack + *offset, block_len);
+  REST.set_header_content_type(response, format == SENML_CBOR ? SENML_CBOR_FORMAT : SENML_JSON_FORMAT);
+  REST.set_header_etag(response, etag, 1);
+  REST.set_response_payload(response, buffer, block_len);
+
+  *offset += block_len;
+  if(*offset >= len) {
+    // the last block
+    *offset = -1;
+  }
+}
+/*---------------------------------------------------------------------------*/
+const char *
+sample_base_name(void)
+{
+  static char base_name[6];
+
+  if(base_name[0] == '\0') {
+    snprintf(base_name, sizeof(base_name), "%x:",
+             (linkaddr_node_addr.u8[LINKADDR_SIZE - 2] << 8) | linkaddr_node_addr.u8[LINKADDR_SIZE - 1]);
+  }
+  return base_name;
+}
@@ -0,0 +1,32 @@
+#include "contiki.h"
+
+/*
+ * Timestamped sample payloads.
+ *
+ * A sample is served either as the bare value (text/plain) or as
+ * {"v":<value>,"n":<sequence>,"t":<ms since the epoch>} (application/json),
+ * with "u" (ms since boot) instead of "t" while the node's time is not set.
+ * The sequence number lets the gateway detect samples it never received.
+ */
+
+// 1 if the response should be JSON: the request's Accept, json_by_default without one
+int sample_wants_json(void *request, int json_by_default);
+// Sets the content format and payload of a sample response; buffer holds the formatted value
+void sample_set_payload(void *response, char *buffer, int json, uint16_t seq, clock_time_t ticks);
+
+/*
+ * SenML packs of several samples (see senml.h): application/senml+cbor if the
+ * request accepts it, else application/senml+json. A pack larger than the
+ * request's block size is served in Block2 blocks, every block with the ETag of
+ * the pack it was cut from (RFC 7959, section 2.4).
+ */
+
+// SENML_CBOR or SENML_JSON, after the request's Accept
+uint8_t sample_pack_format(void *request);
+// Sets the content format, the pack's ETag (1 byte, bumped by the resource on every
+// rebuild, so a client sees blocks of different packs apart) and the block of the pack
+// starting at *offset, and moves *offset on
+void sample_set_pack(void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset,
+                     const uint8_t *pack, uint16_t len, uint8_t format, const uint8_t *etag);
+// "<last 16 bits of the link-layer address in hex>:", the base name of the node's packs
+const char *sample_base_name(void);
@@ -0,0 +1,262 @@
+/**
+ * \file
+ *      SenML pack encoder, see senml.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "senml.h"
+
+/* CBOR labels of the SenML fields (RFC 8428, section 6) */
+#define LABEL_BASE_NAME  -2
+#define LABEL_BASE_TIME  -3
+#define LABEL_BASE_UNIT  -4
+#define LABEL_NAME       0
+#define LABEL_UNIT       1
+#define LABEL_VALUE      2
+#define LABEL_TIME       6
+
+/* CBOR major types */
+#define CBOR_UINT        0x00
+#define CBOR_NINT        0x20
+#define CBOR_TEXT        0x60
+#define CBOR_ARRAY       0x80
+#define CBOR_MAP         0xa0
+#define CBOR_FLOAT32     0xfa
+
+static const int32_t POW10[] = { 1, 10, 100, 1000, 10000 };
+
+/*---------------------------------------------------------------------------*/
+static void
+put(struct senml_pack *pack, const void *data, uint16_t len)
+{
+  /* JSON keeps room for the closing bracket */
+  uint16_t limit = pack->format == SENML_JSON ? pack->size - 1 : pack->size;
+
+  if(pack->overflow || pack->len + len > limit) {
+    pack->overflow = 1;
+    return;
+  }
+  memcpy(pack->buffer + pack->len, data, len);
+  pack->len += len;
+}
+/*---------------------------------------------------------------------------*/
+static void
+put_string(struct senml_pack *pack, const char *string)
+{
+  put(pack, string, strlen(string));
+}
+/*---------------------------------------------------------------------------*/
+static void
+cbor_head(struct senml_pack *pack, uint8_t major, uint32_t argument)
+{
+  uint8_t head[5];
+  uint8_t len;
+
+  if(argument < 24) {
+    head[0] = major | argument;
+    len = 1;
+  } else if(argument <= 0xff) {
+    head[0] = major | 24;
+    head[1] = argument;
+    len = 2;
+  } else if(argument <= 0xffff) {
+    head[0] = major | 25;
+    head[1] = argument >> 8;
+    head[2] = argument;
+    len = 3;
+  } else {
+    head[0] = major | 26;
+    head[1] = argument >> 24;
+    head[2] = argument >> 16;
+    head[3] = argument >> 8;
+    head[4] = argument;
+    len = 5;
+  }
+  put(pack, head, len);
+}
+/*---------------------------------------------------------------------------*/
+static void
+cbor_int(struct senml_pack *pack, int32_t value)
+{
+  if(value >= 0) {
+    cbor_head(pack, CBOR_UINT, value);
+  } else {
+    cbor_head(pack, CBOR_NINT, -(value + 1));
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+cbor_text(struct senml_pack *pack, const char *text)
+{
+  cbor_head(pack, CBOR_TEXT, strlen(text));
+  put_string(pack, text);
+}
+/*---------------------------------------------------------------------------*/
+static void
+cbor_number(struct senml_pack *pack, int32_t value, uint8_t decimals)
+{
+  union {
+    float f;
+    uint32_t u;
+  } number;
+  uint8_t encoded[5];
+
+  if(value % POW10[decimals] == 0) {
+    cbor_int(pack, value / POW10[decimals]);
+    return;
+  }
+  number.f = (float)value / POW10[decimals];
+  encoded[0] = CBOR_FLOAT32;
+  encoded[1] = number.u >> 24;
+  encoded[2] = number.u >> 16;
+  encoded[3] = number.u >> 8;
+  encoded[4] = number.u;
+  put(pack, encoded, sizeof(encoded));
+}
+/*---------------------------------------------------------------------------*/
+static void
+json_number(struct senml_pack *pack, int32_t value, uint8_t decimals)
+{
+  char number[16];
+  uint32_t magnitude = value < 0 ? -(uint32_t)value : (uint32_t)value;
+  uint32_t fraction = magnitude % POW10[decimals];
+  int len;
+
+  len = snprintf(number, sizeof(number), "%s%lu", value < 0 ? "-" : "",
+                 (unsigned long)(magnitude / POW10[decimals]));
+  if(fraction) {
+    // without trailing zeros
+    while(fraction % 10 == 0) {
+      fraction /= 10;
+      decimals--;
+    }
+    snprintf(number + len, sizeof(number) - len, ".%0*lu", decimals, (unsigned long)fraction);
+  }
+  put_string(pack, number);
+}
+/*---------------------------------------------------------------------------*/
+static void
+json_field(struct senml_pack *pack, const char *name, const char *text)
+{
+  put_string(pack, pack->buffer[pack->len - 1] == '{' ? "\"" : ",\"");
+  put_string(pack, name);
+  put_string(pack, "\":");
+  if(text != NULL) {
+    put_string(pack, "\"");
+    put_string(pack, text);
+    put_string(pack, "\"");
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+senml_begin(struct senml_pack *pack, uint8_t *buffer, uint16_t size, uint8_t format,
+            const char *base_name, unsigned long base_time, const char *base_unit)
+{
+  pack->buffer = buffer;
+  pack->size = size;
+  pack->len = 0;
+  pack->format = format;
+  pack->records = 0;
+  pack->overflow = 0;
+  pack->base_name = base_name;
+  pack->base_time = base_time;
+  pack->base_unit = base_unit;
+  /* CBOR: the array header, its count is set by senml_end() */
+  put(pack, format == SENML_JSON ? "[" : "\x80", 1);
+}
+/*---------------------------------------------------------------------------*/
+int
+senml_add(struct senml_pack *pack, const char *name, const char *unit,
+          int32_t value, uint8_t decimals, int32_t time_ms)
+{
+  uint16_t start = pack->len;
+  int first = pack->records == 0;
+  uint8_t fields = 1;
+  char base_time[12];
+
+  if(pack->overflow || pack->records == SENML_MAX_RECORDS) {
+    return 0;
+  }
+
+  if(pack->format == SENML_CBOR) {
+    if(first) {
+      fields += (pack->base_name != NULL) + (pack->base_time != 0) + (pack->base_unit != NULL);
+    }
+    fields += (name != NULL) + (unit != NULL) + (time_ms != 0);
+    cbor_head(pack, CBOR_MAP, fields);
+    if(first && pack->base_name != NULL) {
+      cbor_int(pack, LABEL_BASE_NAME);
+      cbor_text(pack, pack->base_name);
+    }
+    if(first && pack->base_time != 0) {
+      cbor_int(pack, LABEL_BASE_TIME);
+      cbor_head(pack, CBOR_UINT, pack->base_time);
+    }
+    if(first && pack->base_unit != NULL) {
+      cbor_int(pack, LABEL_BASE_UNIT);
+      cbor_text(pack, pack->base_unit);
+    }
+    if(name != NULL) {
+      cbor_int(pack, LABEL_NAME);
+      cbor_text(pack, name);
+    }
+    if(unit != NULL) {
+      cbor_int(pack, LABEL_UNIT);
+      cbor_text(pack, unit);
+    }
+    cbor_int(pack, LABEL_VALUE);
+    cbor_number(pack, value, decimals);
+    if(time_ms != 0) {
+      cbor_int(pack, LABEL_TIME);
+      cbor_number(pack, time_ms, 3);
+    }
+  } else {
+    put_string(pack, first ? "{" : ",{");
+    if(first && pack->base_name != NULL) {
+      json_field(pack, "bn", pack->base_name);
+    }
+    if(first && pack->base_time != 0) {
+      json_field(pack, "bt", NULL);
+      snprintf(base_time, sizeof(base_time), "%lu", pack->base_time);
+      put_string(pack, base_time);
+    }
+    if(first && pack->base_unit != NULL) {
+      json_field(pack, "bu", pack->base_unit);
+    }
+    if(name != NULL) {
+      json_field(pack, "n", name);
+    }
+    if(unit != NULL) {
+      json_field(pack, "u", unit);
+    }
+    json_field(pack, "v", NULL);
+    json_number(pack, value, decimals);
+    if(time_ms != 0) {
+      json_field(pack, "t", NULL);
+      json_number(pack, time_ms, 3);
+    }
+    put_string(pack, "}");
+  }
+
+  if(pack->overflow) {
+    pack->len = start;
+    pack->overflow = 0;
+    return 0;
+  }
+  pack->records++;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+uint16_t
+senml_end(struct senml_pack *pack)
+{
+  if(pack->format == SENML_JSON) {
+    /* always fits, put() kept room for it */
+    pack->buffer[pack->len++] = ']';
+  } else {
+    pack->buffer[0] = CBOR_ARRAY | pack->records;
+  }
+  return pack->len;
+}
@@ -0,0 +1,44 @@
+#include "contiki.h"
+
+/*
+ * SenML packs (RFC 8428) in JSON or CBOR.
+ *
+ * The base name, base time (seconds) and base unit go into the first record
+ * only, so the other records carry little more than their name, value and
+ * time relative to the base time.
+ * Values are fixed point: value / 10^decimals, e.g. 125 with 2 decimals is 1.25.
+ */
+
+#define SENML_JSON 0
+#define SENML_CBOR 1
+
+/* Content-Formats of application/senml+json and application/senml+cbor */
+#define SENML_JSON_FORMAT 110
+#define SENML_CBOR_FORMAT 112
+
+/* A CBOR pack holds up to 23 records, its array header is a single byte */
+#define SENML_MAX_RECORDS 23
+
+struct senml_pack {
+  uint8_t *buffer;
+  uint16_t size;
+  uint16_t len;
+  uint8_t format;
+  uint8_t records;
+  uint8_t overflow;
+  /* base fields, NULL or 0 if unused */
+  const char *base_name;
+  const char *base_unit;
+  unsigned long base_time;
+};
+
+// Starts an empty pack in buffer
+void senml_begin(struct senml_pack *pack, uint8_t *buffer, uint16_t size, uint8_t format,
+                 const char *base_name, unsigned long base_time, const char *base_unit);
+// Adds a record; name NULL if the base name is the whole name, unit NULL for the
+// base unit, time_ms relative to the base time (0: none).
+// Returns 0 if it does not fit, the pack is left as it was.
+int senml_add(struct senml_pack *pack, const char *name, const char *unit,
+              int32_t value, uint8_t decimals, int32_t time_ms);
+// Closes the pack, returns its length
+uint16_t senml_end(struct senml_pack *pack);
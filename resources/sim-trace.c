@@ -0,0 +1,35 @@
+/**
+ * \file
+ *      Deterministic sensor traces for benchmarks, see sim-trace.h.
+ */
+
+#include "contiki.h"
+#include "sim-trace.h"
+
+#ifdef SIM_SEED
+
+int
+sim_trace_steps(struct sim_trace *trace)
+{
+  unsigned long now = clock_seconds();
+  unsigned long steps = now - trace->last;
+
+  /* counted from boot, so the values do not depend on when the sensor is first
+   * read; catching up is a few cycles per second not read, so it is not capped */
+  trace->last = now;
+  return (int)steps;
+}
+/*---------------------------------------------------------------------------*/
+int
+sim_trace_rand(struct sim_trace *trace)
+{
+  /* xorshift32 */
+  uint32_t x = trace->state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  trace->state = x;
+  return (int)(x & 0x7fffffff);
+}
+
+#endif /* SIM_SEED */
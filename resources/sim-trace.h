@@ -0,0 +1,41 @@
+/*
+ * Deterministic sensor traces for benchmarks, enabled with make SIM_SEED=<n>.
+ *
+ * Every simulated sensor then draws from its own generator, advanced once per
+ * second of uptime whether or not the sensor is read, so two firmware variants
+ * built with the same seed see the same values at the same time. Without
+ * SIM_SEED the sensors advance by one rand() step on every read.
+ */
+#ifndef SIM_TRACE_H_
+#define SIM_TRACE_H_
+
+#include <stdlib.h>
+
+#ifdef SIM_SEED
+
+#include <stdint.h>
+
+struct sim_trace {
+  uint32_t state;
+  unsigned long last;
+};
+
+/* Declares the trace of one sensor, stream tells the sensors of one seed apart */
+#define SIM_TRACE(name, stream) \
+  static struct sim_trace name = { (uint32_t)(SIM_SEED) * 2654435761u + (stream) * 40503u + 1, 0 };
+#define SIM_TRACE_STEPS(name) sim_trace_steps(&name)
+#define SIM_TRACE_RAND(name)  sim_trace_rand(&name)
+
+/* Number of steps the sensor has to advance: the seconds since its last read (or boot) */
+int sim_trace_steps(struct sim_trace *trace);
+int sim_trace_rand(struct sim_trace *trace);
+
+#else /* SIM_SEED */
+
+#define SIM_TRACE(name, stream)
+#define SIM_TRACE_STEPS(name) 1
+#define SIM_TRACE_RAND(name)  rand()
+
+#endif /* SIM_SEED */
+
+#endif /* SIM_TRACE_H_ */
@@ -0,0 +1,259 @@
+"""
+Central poll scheduler for the gateway.
+
+Every (node, resource) pair has one schedule on a hierarchical timer wheel
+instead of its own sleeping coroutine. Schedules start at a random phase and
+every period is jittered, so nodes do not poll in lock-step after a restart or
+a moving/stopped change. Polls are admitted by a global and a per-node token
+bucket; a poll that finds no token waits for the next tick.
+
+Periods and limits come from a JSON file (schedule.json) that is re-read when
+it changes, the running schedules pick the new values up at their next poll.
+An invalid file is ignored (the previous configuration stays); the schedules of
+a resource removed from it pause until it is configured again.
+"""
+import asyncio
+import json
+import logging
+import os
+import random
+import time
+
+
+# A paused schedule (its resource is not configured) checks again after this many seconds
+PAUSED_RECHECK = 1.0
+
+
+def validate_config(config):
+    """Raises ValueError if the configuration is incomplete or out of range."""
+    try:
+        if config["tick"] <= 0 or not 0 <= config["jitter"] < 1:
+            raise ValueError("tick must be positive, jitter in [0, 1)")
+        if config["global_rate"] <= 0 or config["node_rate"] <= 0:
+            raise ValueError("rates must be positive")
+        for name, periods in config["resources"].items():
+            if periods["freq_if_moving"] <= 0 or periods["freq_if_stopped"] <= 0:
+                raise ValueError(f"periods of {name} must be positive")
+    except (KeyError, TypeError, AttributeError) as e:
+        raise ValueError(f"malformed configuration: {e!r}")
+
+
+class TimerWheel:
+    """
+    Hierarchical timing wheel: level 0 has `slots` buckets of one tick, level n
+    buckets of slots**n ticks. Adding and expiring is O(1) per item, items of
+    upper levels move down one level each time the level below wraps.
+    """
+
+    def __init__(self, tick, slots=64, levels=3):
+        self.tick = tick
+        self.slots = slots
+        self.levels = [[[] for _ in range(slots)] for _ in range(levels)]
+        self.now = 0  # ticks
+
+    def add(self, delay, item):
+        """Schedules item to expire after delay seconds (at least one tick)."""
+        self._insert(self.now + max(1, round(delay / self.tick)), item)
+
+    def _insert(self, deadline, item):
+        remaining = deadline - self.now
+        for level in range(len(self.levels)):
+            if remaining < self.slots ** (level + 1) or level == len(self.levels) - 1:
+                slot = (deadline // self.slots ** level) % self.slots
+                self.levels[level][slot].append((deadline, item))
+                return
+
+    def advance(self):
+        """Moves one tick forward, returns the items that expired."""
+        self.now += 1
+        for level in range(1, len(self.levels)):
+            if self.now % self.slots ** level:
+                break
+            slot = (self.now // self.slots ** level) % self.slots
+            bucket, self.levels[level][slot] = self.levels[level][slot], []
+            for deadline, item in bucket:
+                self._insert(deadline, item)
+
+        slot = self.now % self.slots
+        bucket, self.levels[0][slot] = self.levels[0][slot], []
+        expired = []
+        for deadline, item in bucket:
+            if deadline <= self.now:
+                expired.append(item)
+            else:
+                self._insert(deadline, item)
+        return expired
+
+
+class TokenBucket:
+    def __init__(self, rate):
+        self.tokens = 0.0
+        self.updated = time.monotonic()
+        self.set_rate(rate)
+
+    def set_rate(self, rate):
+        """rate: tokens per second, also the burst size (at least one)."""
+        self.rate = rate
+        self.burst = max(1.0, rate)
+        self.tokens = min(self.tokens, self.burst)
+
+    def refill(self, now):
+        self.tokens = min(self.burst, self.tokens + (now - self.updated) * self.rate)
+        self.updated = now
+
+
+class Schedule:
+    def __init__(self, node, resource, poll, moving):
+        self.node = node
+        self.resource = resource
+        self.poll = poll
+        self.moving = moving
+        self.generation = 0
+        self.running = False
+        self.removed = False
+        self.paused = False
+
+
+class PollScheduler:
+    def __init__(self, config_path, backpressure=lambda: 1):
+        """
+        :param config_path: schedule.json
+        :param backpressure: returns the factor periods are stretched by
+        """
+        self.config_path = config_path
+        self.config_mtime = None
+        self.backpressure = backpressure
+        self.load_config()
+
+        self.wheel = TimerWheel(self.config["tick"])
+        self.schedules = {}
+        self.global_bucket = TokenBucket(self.config["global_rate"])
+        self.node_buckets = {}
+        self.polls = 0
+        self.deferred = 0
+        self.skipped = 0
+
+    def load_config(self):
+        """(Re)reads the configuration if the file changed, keeps the old one on errors."""
+        try:
+            mtime = os.stat(self.config_path).st_mtime
+            if mtime == self.config_mtime:
+                return
+            with open(self.config_path) as f:
+                config = json.load(f)
+            validate_config(config)
+        except (OSError, ValueError) as e:
+            if self.config_mtime is None:
+                raise
+            logging.warning(f"[scheduler] keeping previous configuration: {e}")
+            return
+
+        self.config = config
+        self.config_mtime = mtime
+        if hasattr(self, "global_bucket"):
+            logging.info(f"[scheduler] reloaded {self.config_path}")
+            self.global_bucket.set_rate(config["global_rate"])
+            for bucket in self.node_buckets.values():
+                bucket.set_rate(config["node_rate"])
+            paused = {resource for _, resource in self.schedules} - set(config["resources"])
+            if paused:
+                logging.warning(f"[scheduler] pausing the polls of unconfigured resources: {sorted(paused)}")
+
+    def period(self, schedule):
+        """:return: the schedule's period in seconds, None if its resource is not configured"""
+        periods = self.config["resources"].get(schedule.resource)
+        if periods is None:
+            return None
+        period = periods["freq_if_moving"] if schedule.moving() else periods["freq_if_stopped"]
+        return period * self.backpressure()
+
+    def add(self, node, resource, poll, moving):
+        """
+        Polls a resource from now on, starting at a random phase of its period.
+        :param poll: coroutine function doing one poll
+        :param moving: returns whether the node moves, selects the period
+        """
+        schedule = Schedule(node, resource, poll, moving)
+        self.schedules[(node, resource)] = schedule
+        if node not in self.node_buckets:
+            self.node_buckets[node] = TokenBucket(self.config["node_rate"])
+        if self.period(schedule) is None:
+            logging.warning(f"[scheduler] {resource} is not configured, not polling it on {node} yet")
+        self._arm_phase(schedule)
+
+    def remove_node(self, node):
+        for key in [key for key in self.schedules if key[0] == node]:
+            self.schedules.pop(key).removed = True
+        self.node_buckets.pop(node, None)
+
+    def rephase(self, node):
+        """Restarts the node's schedules at random phases of their (new) periods."""
+        for (schedule_node, _), schedule in self.schedules.items():
+            if schedule_node == node:
+                self._arm_phase(schedule)
+
+    def _arm_phase(self, schedule):
+        period = self.period(schedule)
+        self._arm(schedule, PAUSED_RECHECK if period is None else random.uniform(0, period))
+
+    def _arm(self, schedule, delay):
+        schedule.generation += 1
+        self.wheel.add(delay, (schedule, schedule.generation))
+
+    def _admit(self, node, now):
+        bucket = self.node_buckets[node]
+        self.global_bucket.refill(now)
+        bucket.refill(now)
+        if self.global_bucket.tokens < 1 or bucket.tokens < 1:
+            return False
+        self.global_bucket.tokens -= 1
+        bucket.tokens -= 1
+        return True
+
+    async def _poll(self, schedule):
+        try:
+            await schedule.poll()
+        except Exception as e:
+            logging.warning(f"[scheduler] {schedule.resource} on {schedule.node}: {e}")
+        finally:
+            schedule.running = False
+
+    def _expire(self, schedule, generation, now):
+        if schedule.removed or generation != schedule.generation:
+            return
+        period = self.period(schedule)
+        if period is None or schedule.paused:
+            # paused while its resource is not configured, resumes at a random phase
+            schedule.paused = period is None
+            self._arm_phase(schedule)
+            return
+        jitter = self.config["jitter"]
+        next_delay = period * random.uniform(1 - jitter, 1 + jitter)
+        if schedule.running:
+            self.skipped += 1
+            self._arm(schedule, next_delay)
+            return
+        if not self._admit(schedule.node, now):
+            # same generation, so it stays the one pending expiry of this schedule
+            self.deferred += 1
+            self.wheel.add(self.wheel.tick, (schedule, generation))
+            return
+
+        # periods are counted start to start, so a slow node does not drift
+        self._arm(schedule, next_delay)
+        schedule.running = True
+        self.polls += 1
+        asyncio.ensure_future(self._poll(schedule))
+
+    async def run(self):
+        next_tick = time.monotonic()
+        ticks_per_reload = max(1, round(1 / self.wheel.tick))
+        while True:
+            next_tick += self.wheel.tick
+            await asyncio.sleep(max(0, next_tick - time.monotonic()))
+            if self.wheel.now % ticks_per_reload == 0:
+                self.load_config()
+
+            now = time.monotonic()
+            for schedule, generation in self.wheel.advance():
+                self._expire(schedule, generation, now)
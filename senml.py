@@ -0,0 +1,169 @@
+"""
+SenML packs (RFC 8428) from the resource servers, in JSON or CBOR.
+
+records() walks a pack one record at a time (JSON records are decoded one by
+one, CBOR items as they come) and resolves the base fields: the name is
+base name + name, the time base time + time, the unit the record's or the base
+unit, numeric values are added to the base value. Times below 2**28 are
+relative to now, a pack without any time was sampled "now" (time None).
+See resources/senml.h for the node's encoder.
+"""
+import json
+import struct
+import time
+from collections import namedtuple
+
+
+JSON_FORMAT = 110
+CBOR_FORMAT = 112
+# CBOR labels of the SenML fields (RFC 8428, section 6)
+LABELS = {-1: "bver", -2: "bn", -3: "bt", -4: "bu", -5: "bv", -6: "bs",
+          0: "n", 1: "u", 2: "v", 3: "vs", 4: "vb", 5: "s", 6: "t", 7: "ut", 8: "vd"}
+RELATIVE_TIME_LIMIT = 2 ** 28
+
+Record = namedtuple("Record", "name unit value time")
+
+
+# JSON ========================================================================
+
+
+def json_items(data):
+    """Yields the objects of a JSON array one at a time."""
+    text = data.decode() if isinstance(data, bytes) else data
+    decoder = json.JSONDecoder()
+    pos = _skip(text, 0)
+    if text[pos:pos + 1] != "[":
+        raise ValueError("SenML JSON is not an array")
+    pos = _skip(text, pos + 1)
+    if text[pos:pos + 1] == "]":
+        return
+    while True:
+        item, pos = decoder.raw_decode(text, pos)
+        yield item
+        pos = _skip(text, pos)
+        if text[pos:pos + 1] == "]":
+            return
+        if text[pos:pos + 1] != ",":
+            raise ValueError(f"unexpected {text[pos:pos + 1]!r} at {pos} in SenML JSON")
+        pos = _skip(text, pos + 1)
+
+
+def _skip(text, pos):
+    while pos < len(text) and text[pos] in " \t\r\n":
+        pos += 1
+    return pos
+
+
+# CBOR ========================================================================
+
+
+def cbor_items(data):
+    """Yields the items of a CBOR array one at a time."""
+    major, argument, pos = _cbor_head(data, 0)
+    if major != 4:
+        raise ValueError("SenML CBOR is not an array")
+    count = 0
+    while argument is None or count < argument:
+        if argument is None and data[pos] == 0xff:
+            return
+        item, pos = _cbor_item(data, pos)
+        yield item
+        count += 1
+
+
+def _cbor_head(data, pos):
+    """:return: (major type, argument or None if indefinite, position after the head)"""
+    initial = data[pos]
+    major, info = initial >> 5, initial & 0x1f
+    pos += 1
+    if info < 24:
+        return major, info, pos
+    if info == 31:
+        return major, None, pos
+    size = {24: 1, 25: 2, 26: 4, 27: 8}.get(info)
+    if size is None:
+        raise ValueError(f"invalid CBOR head {initial:#x}")
+    if major == 7:
+        # floats keep their bytes, see _cbor_item()
+        return major, data[pos:pos + size], pos + size
+    return major, int.from_bytes(data[pos:pos + size], "big"), pos + size
+
+
+def _cbor_item(data, pos):
+    major, argument, pos = _cbor_head(data, pos)
+    if major == 0:
+        return argument, pos
+    if major == 1:
+        return -1 - argument, pos
+    if major in (2, 3):
+        if argument is None:
+            raise ValueError("indefinite CBOR strings are not supported")
+        value = data[pos:pos + argument]
+        return (value.decode() if major == 3 else bytes(value)), pos + argument
+    if major == 4:
+        items = []
+        while argument is None and data[pos] != 0xff or argument is not None and len(items) < argument:
+            item, pos = _cbor_item(data, pos)
+            items.append(item)
+        return items, pos + (argument is None)
+    if major == 5:
+        items = {}
+        while argument is None and data[pos] != 0xff or argument is not None and len(items) < argument:
+            key, pos = _cbor_item(data, pos)
+            items[key], pos = _cbor_item(data, pos)
+        return items, pos + (argument is None)
+    if major == 6:
+        # tags (e.g. decimal fractions) are not used by SenML, take the tagged item
+        return _cbor_item(data, pos)
+    if isinstance(argument, bytes):
+        fmt = {2: ">e", 4: ">f", 8: ">d"}[len(argument)]
+        return struct.unpack(fmt, argument)[0], pos
+    return {20: False, 21: True, 22: None}.get(argument), pos
+
+
+# RECORDS =====================================================================
+
+
+def records(payload, content_format=JSON_FORMAT, now=None):
+    """
+    Yields the resolved records of a pack.
+    :param content_format: CBOR_FORMAT or JSON_FORMAT
+    :param now: time (s) relative times are resolved against, default the current time
+    """
+    now = time.time() if now is None else now
+    cbor = content_format == CBOR_FORMAT
+    base = {"bn": "", "bt": 0, "bu": None, "bv": 0, "bs": 0}
+    for item in cbor_items(payload) if cbor else json_items(payload):
+        if cbor:
+            item = {LABELS.get(key, key): value for key, value in item.items()}
+        for key in base:
+            if key in item:
+                base[key] = item[key]
+
+        if "v" in item:
+            value = base["bv"] + item["v"]
+        elif "s" in item:
+            value = base["bs"] + item["s"]
+        elif "vs" in item or "vb" in item or "vd" in item:
+            value = item.get("vs", item.get("vb", item.get("vd")))
+        else:
+            continue  # only base fields
+
+        t = base["bt"] + item.get("t", 0)
+        if t == 0:
+            t = None
+        elif t < RELATIVE_TIME_LIMIT:
+            t = now + t
+        yield Record(base["bn"] + item.get("n", ""), item.get("u", base["bu"]), value, t)
+
+
+def telemetry(payload, content_format, keys, now=None):
+    """
+    Maps the records of a pack straight to ThingsBoard samples.
+    :param keys: record name -> ThingsBoard key, None to skip the record
+    :return: generator of (key, value, ts in ms or None)
+    """
+    for record in records(payload, content_format, now):
+        key = keys(record.name)
+        if key is not None:
+            yield key, record.value, None if record.time is None else round(record.time * 1000)
@@ -0,0 +1,239 @@
+"""
+Durable write-ahead spool for telemetry uploads, shared by the gateways.
+
+Records (JSON-serializable dicts) are appended to segment files in a spool
+directory and only removed once the upload that contains them has been
+acknowledged, so an unreachable ThingsBoard or a gateway restart does not
+lose data. The spool is bounded: when it grows past its size limit the
+oldest segments are evicted first.
+
+Layout: <dir>/<sequence>.seg holds one JSON record per line,
+<dir>/cursor.json the position of the oldest unacknowledged record.
+
+A Spool is not thread-safe. For a writer that must not wait for the disk,
+append(sync=False) only buffers the write, and sync() and read() take the
+writer's lock for the bookkeeping only; they then have to run on the one
+thread that also acks (deletes segments).
+"""
+import contextlib
+import json
+import logging
+import os
+import time
+
+
+# CONFIG ======================================================================
+
+SEGMENT_BYTES = 1 << 20
+MAX_SPOOL_BYTES = 64 << 20
+# fsync after this many records or seconds, whichever comes first
+FSYNC_RECORDS = 500
+FSYNC_INTERVAL = 1.0
+
+SEGMENT_SUFFIX = ".seg"
+CURSOR_FILE = "cursor.json"
+
+
+class Spool:
+
+    def __init__(self, directory, segment_bytes=SEGMENT_BYTES, max_bytes=MAX_SPOOL_BYTES,
+                 fsync_records=FSYNC_RECORDS, fsync_interval=FSYNC_INTERVAL):
+        self.directory = directory
+        self.segment_bytes = segment_bytes
+        self.max_bytes = max_bytes
+        self.fsync_records = fsync_records
+        self.fsync_interval = fsync_interval
+        self.evicted = 0
+
+        os.makedirs(directory, exist_ok=True)
+        # sequence -> size in bytes, oldest first
+        self.segments = {}
+        for name in sorted(os.listdir(directory)):
+            if name.endswith(SEGMENT_SUFFIX):
+                seq = int(name[:-len(SEGMENT_SUFFIX)])
+                self.segments[seq] = os.path.getsize(self._segment_path(seq))
+        self.read_seq, self.read_offset = self._load_cursor()
+
+        # never append to a segment left by a previous run, its tail may be torn
+        self.write_seq = max(self.segments, default=0) + 1
+        self.write_file = None
+        # rotated out by append(sync=False), fsynced and closed by the next sync()
+        self.rotated = []
+        self.unsynced = 0
+        self.last_sync = time.monotonic()
+        if self.segments:
+            logging.info(f"Spool {directory}: replaying {self.pending_bytes()} bytes "
+                         f"from {len(self.segments)} segment(s)")
+
+    # PATHS / CURSOR ==========================================================
+
+    def _segment_path(self, seq):
+        return os.path.join(self.directory, f"{seq:012d}{SEGMENT_SUFFIX}")
+
+    def _load_cursor(self):
+        try:
+            with open(os.path.join(self.directory, CURSOR_FILE)) as f:
+                cursor = json.load(f)
+            return cursor["segment"], cursor["offset"]
+        except (OSError, ValueError, KeyError):
+            return min(self.segments, default=1), 0
+
+    def _save_cursor(self):
+        path = os.path.join(self.directory, CURSOR_FILE)
+        with open(path + ".tmp", "w") as f:
+            json.dump({"segment": self.read_seq, "offset": self.read_offset}, f)
+        os.replace(path + ".tmp", path)
+
+    # WRITING =================================================================
+
+    def append(self, record, sync=True):
+        """
+        Appends one record. Durable after the next sync().
+        :param sync: also fsync (when due) and evict here; False only buffers the write,
+                     the caller runs sync() itself
+        """
+        line = (json.dumps(record, separators=(",", ":")) + "\n").encode()
+        if self.write_file is None or self.segments[self.write_seq] + len(line) > self.segment_bytes:
+            self._rotate(sync)
+        self.write_file.write(line)
+        self.segments[self.write_seq] += len(line)
+        self.unsynced += 1
+        if sync:
+            if (self.unsynced >= self.fsync_records
+                    or time.monotonic() - self.last_sync >= self.fsync_interval):
+                self.sync()
+            self._evict()
+
+    def sync(self, lock=None):
+        """
+        Flushes appended records to disk (batched fsync), then evicts if the spool is over its limit.
+        :param lock: held while touching the spool but not during the fsync, if another thread appends
+        """
+        lock = lock or contextlib.nullcontext()
+        with lock:
+            files = self.rotated + ([self.write_file] if self.write_file is not None and self.unsynced else [])
+            self.rotated = []
+            for f in files:
+                f.flush()
+            self.unsynced = 0
+            self.last_sync = time.monotonic()
+        for f in files:
+            os.fsync(f.fileno())
+        with lock:
+            for f in files:
+                # the write file may have been rotated out meanwhile, the next sync() closes it then
+                if f is not self.write_file and f not in self.rotated:
+                    f.close()
+            self._evict()
+
+    def _rotate(self, sync=True):
+        if self.write_file is not None:
+            if sync:
+                self.sync()
+                self.write_file.close()
+            else:
+                self.write_file.flush()
+                self.rotated.append(self.write_file)
+            self.write_seq += 1
+        self.write_file = open(self._segment_path(self.write_seq), "ab")
+        self.segments[self.write_seq] = 0
+
+    def _evict(self):
+        """Drops the oldest segments while the spool is over its size limit."""
+        while sum(self.segments.values()) > self.max_bytes and len(self.segments) > 1:
+            seq = min(self.segments)
+            evicted_records = self._count_records(seq, self.read_offset if seq == self.read_seq else 0)
+            self._delete_segment(seq)
+            if self.read_seq <= seq:
+                self.read_seq, self.read_offset = min(self.segments), 0
+                self._save_cursor()
+            self.evicted += evicted_records
+            logging.warning(f"Spool full, evicted {evicted_records} oldest records ({self.evicted} total)")
+
+    def _delete_segment(self, seq):
+        self.segments.pop(seq, None)
+        try:
+            os.remove(self._segment_path(seq))
+        except OSError:
+            pass
+
+    def _count_records(self, seq, offset):
+        try:
+            with open(self._segment_path(seq), "rb") as f:
+                f.seek(offset)
+                return f.read().count(b"\n")
+        except OSError:
+            return 0
+
+    # READING =================================================================
+
+    def read(self, max_records, lock=None):
+        """
+        Returns (records, cursor) with up to max_records of the oldest
+        unacknowledged records; pass cursor to ack() once they are uploaded.
+        :param lock: held while looking up the segments but not while reading them, if another
+                     thread appends (segments are only deleted by the thread calling read())
+        """
+        with lock or contextlib.nullcontext():
+            if self.write_file is not None:
+                self.write_file.flush()
+            read_seq, read_offset = self.read_seq, self.read_offset
+            seqs = sorted(s for s in self.segments if s >= read_seq)
+        records = []
+        seq, offset = read_seq, read_offset
+        for seq in seqs:
+            if seq != read_seq:
+                offset = 0
+            with open(self._segment_path(seq), "rb") as f:
+                f.seek(offset)
+                for line in f:
+                    if not line.endswith(b"\n"):
+                        # torn write from a crash, or not flushed yet
+                        break
+                    offset += len(line)
+                    try:
+                        records.append(json.loads(line))
+                    except ValueError:
+                        logging.warning(f"Spool: skipping corrupt record in segment {seq}")
+                    if len(records) >= max_records:
+                        return records, (seq, offset)
+        return records, (seq, offset)
+
+    def ack(self, cursor):
+        """
+        Marks everything before cursor as uploaded and deletes consumed segments.
+        The cursor never moves backwards: if segments were evicted while the upload
+        ran, only the part of it that is still spooled counts.
+        """
+        seq, offset = cursor
+        oldest = min(self.segments, default=seq)
+        if seq < oldest:
+            seq, offset = oldest, 0
+        if (seq, offset) <= (self.read_seq, self.read_offset):
+            return
+        self.read_seq, self.read_offset = seq, offset
+        for seq in [s for s in self.segments if s < self.read_seq]:
+            self._delete_segment(seq)
+        if self.read_seq != self.write_seq and self.read_offset >= self.segments.get(self.read_seq, 0):
+            # sealed segment fully consumed
+            next_seqs = [s for s in self.segments if s > self.read_seq]
+            if next_seqs:
+                self._delete_segment(self.read_seq)
+                self.read_seq, self.read_offset = min(next_seqs), 0
+        self._save_cursor()
+
+    # BACKPRESSURE ============================================================
+
+    def pending_bytes(self):
+        """Bytes not yet acknowledged."""
+        return sum(size for seq, size in self.segments.items() if seq >= self.read_seq) - self.read_offset
+
+    def fill_ratio(self):
+        """Fraction of the size limit used by unacknowledged records, 0..1."""
+        return min(1.0, self.pending_bytes() / self.max_bytes)
+
+    def close(self):
+        self.sync()
+        if self.write_file is not None:
+            self.write_file.close()
+            self.write_file = None
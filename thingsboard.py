@@ -0,0 +1,366 @@
+"""
+ThingsBoard telemetry upload, shared by the gateways.
+
+HttpSession keeps one keep-alive HTTP connection to ThingsBoard, MqttSession
+one MQTT session with its device API; make_session() picks one by URL scheme.
+Records go through a write-ahead Spool first and are only removed once
+ThingsBoard acknowledged them, so outages cost no data.
+BatchUploader is the asyncio upload stage of client.py: samples are spooled
+without blocking the event loop (fsyncs, reads and deletions of the spool run
+on a thread of their own), merged into timestamped [{ts, values}]
+batches and flushed when the batch is full or has waited long enough.
+drain_spool() is the blocking equivalent for forward_monitoring_data.py.
+"""
+import asyncio
+import concurrent.futures
+import contextlib
+import http.client
+import json
+import logging
+import os
+import socket
+import threading
+import time
+import urllib.parse
+
+import metrics
+import tracing
+from spool import Spool
+
+
+# CONFIG ======================================================================
+
+# http://host:port uploads with HTTP POSTs, mqtt://host:port over one MQTT session
+THINGSBOARD_URL = os.environ.get("THINGSBOARD_URL", "http://mauro.rezel.net:8080")
+THINGSBOARD_HEADERS = {'Content-Type': 'application/json'}
+
+# MQTT device API: the device token is the user name, the topic is always the same
+MQTT_TELEMETRY_TOPIC = "v1/devices/me/telemetry"
+# 1: a batch counts as uploaded once the broker acknowledged it; 0: once it is sent
+MQTT_QOS = int(os.environ.get("THINGSBOARD_MQTT_QOS", 1))
+MQTT_KEEPALIVE = 60
+
+# Flush a batch when it holds this many samples...
+MAX_BATCH_SAMPLES = int(os.environ.get("THINGSBOARD_MAX_BATCH", 200))
+# ... or when its oldest sample waited this long (seconds)
+MAX_BATCH_DELAY = 1.0
+# Upper bound on the upload rate (records/s), so replaying a backlog after
+# an outage does not flood ThingsBoard
+MAX_REPLAY_RATE = 2000
+# Retry delays after a failed upload (seconds)
+MIN_RETRY_DELAY = 1
+MAX_RETRY_DELAY = 60
+# Polling slows down up to this factor as the spool fills up
+MAX_BACKPRESSURE_SLOWDOWN = 10
+
+
+# METRICS =====================================================================
+
+UPLOAD_SAMPLES = metrics.histogram("gateway_upload_batch_samples", "Samples per ThingsBoard upload",
+                                   buckets=metrics.SIZE_BUCKETS)
+UPLOAD_LATENCY = metrics.histogram("gateway_upload_latency_seconds", "Duration of ThingsBoard uploads")
+UPLOAD_AGE = metrics.histogram("gateway_upload_sample_age_seconds",
+                               "Age of the oldest sample of a batch when ThingsBoard acknowledged it")
+UPLOAD_FAILURES = metrics.counter("gateway_upload_failures_total", "Failed ThingsBoard uploads")
+
+
+# AUX FUNCTIONS ===============================================================
+
+
+def get_telemetry_path(device):
+    return f"/api/v1/{device}/telemetry"
+
+
+def now_ms():
+    return int(time.time() * 1000)
+
+
+def make_batch(records):
+    """
+    Merges records sharing a timestamp into one.
+    :param records: iterable of {"ts": ts in ms, "values": {key: value}}
+    :return: list of {"ts": ts, "values": {key: value}}, one entry per timestamp
+    """
+    by_ts = {}
+    for record in records:
+        by_ts.setdefault(record["ts"], {}).update(record["values"])
+    return [{"ts": ts, "values": values} for ts, values in sorted(by_ts.items())]
+
+
+def observe_upload(records, started):
+    """Records the metrics of a successful upload that started at time.monotonic() `started`."""
+    UPLOAD_SAMPLES.observe(len(records))
+    UPLOAD_LATENCY.observe(time.monotonic() - started)
+    # forward_monitoring_data.py keeps the .oml timestamps as strings
+    UPLOAD_AGE.observe((now_ms() - min(int(record["ts"]) for record in records)) / 1000)
+    tracing.observe_uploaded(records)
+
+
+def backpressure(spool):
+    """Factor (>= 1) to stretch polling periods by, growing as the spool fills up."""
+    return 1 + (MAX_BACKPRESSURE_SLOWDOWN - 1) * spool.fill_ratio()
+
+
+class UploadError(Exception):
+    pass
+
+
+# HTTP ========================================================================
+
+
+class HttpSession:
+    """
+    Persistent HTTP/1.1 connection to ThingsBoard.
+    Blocking, and not thread-safe: use it from one thread at a time.
+    """
+
+    def __init__(self, device, base_url=THINGSBOARD_URL, timeout=10):
+        self.path = get_telemetry_path(device)
+        url = urllib.parse.urlsplit(base_url)
+        self.host = url.hostname
+        self.port = url.port or 80
+        self.timeout = timeout
+        self.conn = None
+
+    def _connect(self):
+        self.conn = http.client.HTTPConnection(self.host, self.port, timeout=self.timeout)
+
+    def close(self):
+        if self.conn is not None:
+            self.conn.close()
+            self.conn = None
+
+    def post_json(self, path, payload):
+        body = json.dumps(payload, separators=(",", ":")).encode()
+        # a kept-alive connection may have been closed by the server meanwhile,
+        # so retry once on a fresh connection
+        for attempt in range(2):
+            if self.conn is None:
+                self._connect()
+            try:
+                self.conn.request("POST", path, body=body, headers=THINGSBOARD_HEADERS)
+                response = self.conn.getresponse()
+                response.read()
+            except (http.client.HTTPException, OSError) as e:
+                self.close()
+                if attempt == 1:
+                    raise UploadError(f"Could not reach ThingsBoard: {e}") from e
+                continue
+            if response.will_close:
+                self.close()
+            if not 200 <= response.status < 300:
+                raise UploadError(f"ThingsBoard answered {response.status} {response.reason}")
+            return
+
+    def send(self, batch):
+        """Uploads one telemetry batch, raises UploadError on failure."""
+        self.post_json(self.path, batch)
+
+
+# MQTT ========================================================================
+
+
+class MqttSession:
+    """
+    Persistent MQTT session with ThingsBoard (or any broker, e.g. mosquitto).
+    paho's network thread keeps the connection alive and reconnects; the broker
+    keeps the session (clean_session=False), so QoS 1 state survives reconnects.
+    send() is blocking, use it from one thread at a time.
+    """
+
+    def __init__(self, device, base_url, qos=MQTT_QOS, timeout=10, instance=""):
+        """instance: tells apart several sessions of one device, the broker allows one per client id"""
+        import paho.mqtt.client as mqtt
+
+        url = urllib.parse.urlsplit(base_url)
+        self.qos = qos
+        self.timeout = timeout
+        self.connected = threading.Event()
+        self.client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2,
+                                  client_id=f"gin206-{socket.gethostname()}-{device}{instance and '-' + instance}",
+                                  clean_session=False)
+        self.client.username_pw_set(device)
+        self.client.on_connect = self._on_connect
+        self.client.on_disconnect = self._on_disconnect
+        self.client.reconnect_delay_set(MIN_RETRY_DELAY, MAX_RETRY_DELAY)
+        self.client.connect_async(url.hostname, url.port or 1883, keepalive=MQTT_KEEPALIVE)
+        self.client.loop_start()
+
+    def _on_connect(self, client, userdata, flags, reason_code, properties):
+        if reason_code.is_failure:
+            logging.warning(f"ThingsBoard refused the MQTT connection: {reason_code}")
+            return
+        self.connected.set()
+
+    def _on_disconnect(self, client, userdata, flags, reason_code, properties):
+        self.connected.clear()
+
+    def close(self):
+        self.client.disconnect()
+        self.client.loop_stop()
+
+    def send(self, batch):
+        """Publishes one telemetry batch, raises UploadError unless it went out (QoS 0) or was acknowledged (QoS 1)."""
+        if not self.connected.wait(self.timeout):
+            raise UploadError("Could not reach ThingsBoard over MQTT")
+        info = self.client.publish(MQTT_TELEMETRY_TOPIC, json.dumps(batch, separators=(",", ":")), qos=self.qos)
+        try:
+            info.wait_for_publish(self.timeout)
+        except (RuntimeError, ValueError) as e:
+            raise UploadError(f"Could not publish to ThingsBoard: {e}") from e
+        if not info.is_published():
+            raise UploadError("ThingsBoard did not acknowledge the batch in time")
+
+
+def make_session(device, base_url=THINGSBOARD_URL, instance=""):
+    """Session for the transport selected by the URL scheme (http or mqtt)."""
+    if urllib.parse.urlsplit(base_url).scheme == "mqtt":
+        return MqttSession(device, base_url, instance=instance)
+    return HttpSession(device, base_url)
+
+
+# UPLOAD STAGE ================================================================
+
+
+def drain_spool(spool, session, max_batch=MAX_BATCH_SAMPLES, lock=None):
+    """
+    Uploads spooled records in batches until the spool is empty (blocking).
+    :param lock: held while touching the spool (not while sending), if other threads append to it
+    :return: True if everything was uploaded, False if ThingsBoard failed
+    """
+    lock = lock or contextlib.nullcontext()
+    with lock:
+        spool.sync()
+    while True:
+        with lock:
+            records, cursor = spool.read(max_batch)
+        if not records:
+            return True
+        started = time.monotonic()
+        try:
+            session.send(make_batch(records))
+        except UploadError as err:
+            UPLOAD_FAILURES.inc()
+            logging.warning(f"Error while posting data to Thingsboard, keeping it spooled: {err}")
+            return False
+        observe_upload(records, started)
+        with lock:
+            spool.ack(cursor)
+        time.sleep(len(records) / MAX_REPLAY_RATE)
+
+
+class BatchUploader:
+    """
+    Asynchronous, batched and spooled upload of samples to one ThingsBoard device.
+    put() never blocks; run() must be running as a task to send the batches.
+    """
+
+    def __init__(self, device, spool_dir, base_url=THINGSBOARD_URL,
+                 max_batch=MAX_BATCH_SAMPLES, max_delay=MAX_BATCH_DELAY):
+        self.session = make_session(device, base_url)
+        self.spool = Spool(spool_dir)
+        self.max_batch = max_batch
+        self.max_delay = max_delay
+        # set when a full batch is waiting
+        self.batch_ready = asyncio.Event()
+        self.queued = 0
+        # one thread owns the connection, so the event loop never blocks on HTTP
+        self.executor = concurrent.futures.ThreadPoolExecutor(max_workers=1)
+        # and one the spool's disk work, put() only buffers the write; the lock
+        # covers the spool's bookkeeping, never an fsync
+        self.spool_executor = concurrent.futures.ThreadPoolExecutor(max_workers=1)
+        self.spool_lock = threading.Lock()
+
+    def put(self, key, value, ts=None, trace=None):
+        """
+        Spools one sample, timestamped now unless ts (ms) is given.
+        :param trace: hop timestamps of the sample, see tracing.py
+        """
+        record = {"ts": ts if ts is not None else now_ms(), "values": {key: value}}
+        if trace is not None:
+            record["trace"] = trace
+        with self.spool_lock:
+            self.spool.append(record, sync=False)
+        self.queued += 1
+        if self.queued >= self.max_batch:
+            self.batch_ready.set()
+
+    def backpressure(self):
+        with self.spool_lock:
+            return backpressure(self.spool)
+
+    def pending_bytes(self):
+        with self.spool_lock:
+            return self.spool.pending_bytes()
+
+    def fill_ratio(self):
+        with self.spool_lock:
+            return self.spool.fill_ratio()
+
+    async def _on_spool_thread(self, function, *args):
+        return await asyncio.get_running_loop().run_in_executor(self.spool_executor, function, *args)
+
+    def _read(self):
+        return self.spool.read(self.max_batch, self.spool_lock)
+
+    def _sync(self):
+        self.spool.sync(self.spool_lock)
+
+    def _ack(self, cursor):
+        with self.spool_lock:
+            self.spool.ack(cursor)
+
+    def _close(self):
+        self._sync()
+        with self.spool_lock:
+            self.spool.close()
+
+    async def _wait_for_batch(self):
+        """Returns when a full batch is waiting or after max_delay."""
+        self.batch_ready.clear()
+        try:
+            await asyncio.wait_for(self.batch_ready.wait(), self.max_delay)
+        except asyncio.TimeoutError:
+            pass
+
+    async def upload(self, records):
+        """Sends records as one batch; returns True on success."""
+        batch = make_batch(records)
+        loop = asyncio.get_running_loop()
+        started = time.monotonic()
+        try:
+            await loop.run_in_executor(self.executor, self.session.send, batch)
+        except UploadError as err:
+            UPLOAD_FAILURES.inc()
+            logging.warning(f"Error while posting data to Thingsboard, keeping it spooled: {err}")
+            return False
+        observe_upload(records, started)
+        logging.debug(f"Posted {len(records)} samples in {len(batch)} records to Thingsboard")
+        return True
+
+    async def run(self):
+        retry_delay = 0
+        try:
+            while True:
+                records, cursor = await self._on_spool_thread(self._read)
+                if len(records) < self.max_batch:
+                    # not a full batch (nor a backlog to replay), give it time to fill
+                    await self._wait_for_batch()
+                    await self._on_spool_thread(self._sync)
+                    records, cursor = await self._on_spool_thread(self._read)
+                self.queued = 0
+                if not records:
+                    continue
+
+                if not await self.upload(records):
+                    retry_delay = min(max(MIN_RETRY_DELAY, retry_delay * 2), MAX_RETRY_DELAY)
+                    await asyncio.sleep(retry_delay)
+                    continue
+                retry_delay = 0
+                await self._on_spool_thread(self._ack, cursor)
+                await asyncio.sleep(len(records) / MAX_REPLAY_RATE)
+        finally:
+            self.spool_executor.submit(self._close)
+            self.spool_executor.shutdown(wait=False)
+            self.executor.submit(self.session.close)
+            self.executor.shutdown(wait=False)
@@ -0,0 +1,167 @@
+"""
+Time synchronization of the resource servers.
+
+The motes only count time since boot. The gateway PUTs its UNIX time
+("<seconds>.<ms>") to each node's "tm" resource every TIME_SYNC_PERIOD seconds;
+the node resets its offset to it and uses the error its clock had accumulated
+since the previous sync to estimate its drift (resources/res-time.c), so its
+timestamps stay accurate between syncs. The first syncs come every
+FAST_SYNC_PERIOD seconds, until the drift estimate has settled. The second sync
+follows the first within seconds, so the initial offset is corrected for the
+delay before the node learns drift from it.
+
+The time sent is the gateway's time plus half the round trip of the previous
+sync, i.e. the expected time of arrival. A sync that needed a retransmission
+arrives seconds late: the node steps to it without learning drift from it and
+the gateway repeats the sync soon.
+
+The node answers with the error it corrected (ms) and its drift estimate (ppm),
+exported as gauges per node.
+
+client.py syncs every node it polls; for nodes that post to ThingsBoard on their
+own (direct telemetry) run it alone:
+  python3 timesync.py <node address> [...]
+"""
+import asyncio
+import contextlib
+import logging
+import os
+import sys
+import time
+
+import aiocoap
+import aiocoap.error
+
+import metrics
+
+
+# CONFIG ======================================================================
+
+TIME_PATH = "tm"
+# Seconds between syncs once the drift is known, 0 disables synchronization
+TIME_SYNC_PERIOD = float(os.environ.get("TIME_SYNC_PERIOD", 900))
+# The next FAST_SYNCS syncs of a node come this often (seconds); the node
+# learns no drift from syncs closer than 120 s
+FAST_SYNC_PERIOD = 120
+FAST_SYNCS = 4
+# A round trip longer than this (seconds) went through a retransmission
+MAX_SYNC_RTT = 1.0
+# Seconds before repeating a failed or late sync
+SYNC_RETRY = 10
+
+
+# METRICS =====================================================================
+
+
+CLOCK_ERROR = metrics.gauge("gateway_node_clock_error_seconds",
+                            "Error of the node's clock the last sync corrected (gateway minus node)", ("node",))
+CLOCK_DRIFT = metrics.gauge("gateway_node_clock_drift_ppm",
+                            "Drift of the node's clock the node corrects for", ("node",))
+SYNCS = metrics.counter("gateway_time_syncs_total", "Time syncs sent, per result: ok, late, failed",
+                        ("node", "result"))
+
+
+def format_time(seconds):
+    """UNIX time as the node parses it, "<seconds>.<ms>"."""
+    ms = int(seconds * 1000)
+    return f"{ms // 1000}.{ms % 1000:03d}"
+
+
+def parse_sync_response(payload):
+    """:return: (error in seconds, drift in ppm), None on the first sync of a node"""
+    fields = payload.decode(errors="replace").split()
+    if len(fields) != 2:
+        return None
+    return int(fields[0]) / 1000, int(fields[1])
+
+
+@contextlib.asynccontextmanager
+async def no_limit(node):
+    yield
+
+
+class TimeSync:
+    """Keeps the clocks of the nodes in sync, one run() per node."""
+
+    def __init__(self, protocol, limit=no_limit):
+        """
+        :param protocol: aiocoap context
+        :param limit: node -> async context manager held around each request, e.g. a request slot
+        """
+        self.protocol = protocol
+        self.limit = limit
+        # node -> half the round trip of its last sync, seconds
+        self.delays = {}
+
+    async def sync(self, node):
+        """
+        One sync.
+        :return: "ok", "late" (to repeat) or "set" if the node had no time yet, i.e. restarted
+        """
+        async with self.limit(node):
+            delay = self.delays.get(node, 0.0)
+            sent = time.time()
+            request = aiocoap.Message(code=aiocoap.PUT, uri=f"coap://[{node}]/{TIME_PATH}",
+                                      payload=format_time(sent + delay).encode())
+            response = await self.protocol.request(request).response
+            rtt = time.time() - sent
+        if not response.code.is_successful():
+            raise aiocoap.error.Error(f"{TIME_PATH}: {response.code}")
+        if rtt > MAX_SYNC_RTT:
+            SYNCS.inc(node, "late")
+            logging.info(f"[{node}] time sync took {rtt:.1f} s, repeating it")
+            return "late"
+
+        self.delays[node] = rtt / 2
+        SYNCS.inc(node, "ok")
+        result = parse_sync_response(response.payload)
+        if result is None:
+            logging.info(f"[{node}] time set")
+            return "set"
+        error, drift = result
+        CLOCK_ERROR.set(error, node)
+        CLOCK_DRIFT.set(drift, node)
+        logging.debug(f"[{node}] clock corrected by {error * 1000:.0f} ms, drift {drift} ppm")
+        return "ok"
+
+    async def run(self, node):
+        """Syncs the node forever, until cancelled."""
+        if not TIME_SYNC_PERIOD:
+            return
+        syncs = 0
+        try:
+            while True:
+                try:
+                    result = await self.sync(node)
+                except Exception as e:
+                    SYNCS.inc(node, "failed")
+                    logging.warning(f"[{node}] time sync failed: {e}")
+                    result = "late"
+                if result == "late":
+                    await asyncio.sleep(SYNC_RETRY)
+                    continue
+                # a restarted node has lost its drift estimate too
+                syncs = 1 if result == "set" else syncs + 1
+                if syncs == 1:
+                    # the round trip is known now, correct the offset for it
+                    await asyncio.sleep(SYNC_RETRY)
+                else:
+                    await asyncio.sleep(FAST_SYNC_PERIOD if syncs <= 1 + FAST_SYNCS else TIME_SYNC_PERIOD)
+        finally:
+            self.delays.pop(node, None)
+
+
+async def main(nodes):
+    protocol = await aiocoap.Context.create_client_context()
+    timesync = TimeSync(protocol)
+    try:
+        await asyncio.gather(*(timesync.run(node) for node in nodes))
+    finally:
+        await protocol.shutdown()
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.DEBUG)
+    if len(sys.argv) < 2:
+        sys.exit(f"Usage: {sys.argv[0]} <node address> [...]")
+    asyncio.run(main(sys.argv[1:]))
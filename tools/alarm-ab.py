@@ -0,0 +1,268 @@
+#!/usr/bin/env python3
+"""
+A/B energy benchmark of the use_accel_alarm optimization on IoT-LAB.
+
+Builds resource-server twice with the same SIM_SEED (USE_ACCEL_ALARM=1 and 0,
+WITH_ENERGEST=1), flashes the variants on two M3 nodes of the running experiment,
+resets them together and drives both through the same seeded workload of
+motion/stationary phases over their serial ports. It then reports per variant:
+  energy/h        from the node's consumption .oml (needs a consumption monitoring
+                  profile on the experiment), else estimated from Energest print-outs
+  notifications   alarm status changes, i.e. observe notifications, per alarm
+  latency         from the start of a motion phase to each alarm's first status
+                  change in it (p50 / max over the phases)
+
+Run it on the SSH frontend, from the repository root:
+  python3 tools/alarm-ab.py --nodes 101,102 [--duration 3600] [--seed 1] [--out alarm-ab]
+  python3 tools/alarm-ab.py --report alarm-ab     recomputes the report of a previous run
+"""
+import argparse
+import json
+import os
+import random
+import re
+import shutil
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+sys.path.insert(0, ROOT)
+from oml_archive import read_oml  # noqa: E402
+
+VARIANTS = {"optimized": 1, "baseline": 0}  # name -> USE_ACCEL_ALARM
+SERIAL_PORT = 20000  # serial of each node, reachable from the frontend
+BOOT_TIME = 10  # seconds between the reset and the first phase
+MOVING_ACCEL = 1500  # milli-g, above the accel alarm threshold
+# rough supply currents (mA) of the M3 (STM32F103 + AT86RF231) for the Energest estimate
+CURRENTS = {"cpu": 27.0, "lpm": 6.0, "tx": 14.0, "rx": 12.3}
+VOLTAGE = 3.3
+
+STATUS_RE = re.compile(r"\[res-alarm-(\w+)\] status changed to (\d+)")
+ENERGEST_RE = re.compile(r"\[energest\] clock=(\d+) rtimer_second=(\d+) cpu=(\d+) lpm=(\d+) tx=(\d+) rx=(\d+)")
+
+
+# WORKLOAD ====================================================================
+
+
+def make_phases(seed, duration, min_phase, max_phase):
+    """Alternating stationary/moving phases of random length, starting stationary."""
+    rng = random.Random(seed)
+    phases = []
+    start = 0.0
+    moving = False
+    while start < duration:
+        length = min(rng.uniform(min_phase, max_phase), duration - start)
+        phases.append({"start": start, "end": start + length, "moving": moving})
+        start += length
+        moving = not moving
+    return phases
+
+
+class SerialLog(threading.Thread):
+    """Records the lines of a node's serial port with their arrival time."""
+
+    def __init__(self, host, path):
+        super().__init__(daemon=True)
+        self.sock = socket.create_connection((host, SERIAL_PORT), timeout=10)
+        self.sock.settimeout(None)
+        self.file = open(path, "w")
+
+    def run(self):
+        buffer = b""
+        while True:
+            try:
+                data = self.sock.recv(4096)
+            except OSError:
+                break
+            if not data:
+                break
+            buffer += data
+            *lines, buffer = buffer.split(b"\n")
+            now = time.time()
+            for line in lines:
+                self.file.write(json.dumps({"t": now, "line": line.decode(errors="replace").strip()}) + "\n")
+            self.file.flush()
+
+    def send(self, line):
+        self.sock.sendall(line.encode() + b"\n")
+
+    def close(self):
+        self.sock.close()
+        self.join(5)
+        self.file.close()
+
+
+def run(command):
+    print("+", " ".join(command))
+    subprocess.run(command, cwd=ROOT, check=True)
+
+
+def build(seed, out):
+    firmwares = {}
+    for name, use_accel_alarm in VARIANTS.items():
+        run(["make", "clean", "TARGET=iotlab-m3"])
+        run(["make", "TARGET=iotlab-m3", f"USE_ACCEL_ALARM={use_accel_alarm}", f"SIM_SEED={seed}", "WITH_ENERGEST=1"])
+        firmwares[name] = os.path.join(out, f"resource-server.{name}.iotlab-m3")
+        shutil.copy(os.path.join(ROOT, "resource-server.iotlab-m3"), firmwares[name])
+    return firmwares
+
+
+def experiment_id():
+    return json.loads(subprocess.getoutput("iotlab-experiment get -p"))["id"]
+
+
+def benchmark(args):
+    os.makedirs(args.out, exist_ok=True)
+    nodes = dict(zip(VARIANTS, args.nodes.split(",")))
+    firmwares = build(args.seed, args.out) if not args.skip_build else {
+        name: os.path.join(args.out, f"resource-server.{name}.iotlab-m3") for name in VARIANTS}
+    for name, node in nodes.items():
+        run(["iotlab-node", "--flash", firmwares[name], "-l", f"{args.site},m3,{node}"])
+
+    phases = make_phases(args.seed, args.duration, args.min_phase, args.max_phase)
+    logs = {name: SerialLog(f"m3-{node}", os.path.join(args.out, f"serial.{name}.jsonl"))
+            for name, node in nodes.items()}
+    for log in logs.values():
+        log.start()
+    run(["iotlab-node", "--reset", "-l", f"{args.site},m3,{'+'.join(nodes.values())}"])
+    time.sleep(BOOT_TIME)
+
+    started = time.time()
+    for phase in phases:
+        time.sleep(max(0.0, started + phase["start"] - time.time()))
+        phase["t"] = time.time()
+        for log in logs.values():
+            log.send(f"accel {MOVING_ACCEL if phase['moving'] else 0}")
+    time.sleep(max(0.0, started + args.duration - time.time()))
+    ended = time.time()
+    for log in logs.values():
+        log.send("accel auto")
+        log.close()
+
+    with open(os.path.join(args.out, "run.json"), "w") as f:
+        json.dump({"seed": args.seed, "experiment": experiment_id(), "nodes": nodes,
+                   "started": started, "ended": ended, "phases": phases}, f, indent=2)
+    # the consumption .oml is written with a few seconds of delay
+    time.sleep(10)
+    report(args.out)
+
+
+# REPORT ======================================================================
+
+
+def oml_energy(experiment, node, started, ended):
+    """Joules from the node's consumption monitoring between started and ended, None without data."""
+    path = os.path.join(os.environ.get("HOME"), ".iot-lab", str(experiment), "consumption", f"m3_{node}.oml")
+    if not os.path.exists(path):
+        return None
+    columns, _ = read_oml(path, "consumption")
+    samples = [(ts / 1e6, power) for ts, power in zip(columns["timestamp"], columns["power"])
+               if started * 1e6 <= ts <= ended * 1e6]
+    if len(samples) < 2:
+        return None
+    return sum((t1 - t0) * (p0 + p1) / 2 for (t0, p0), (t1, p1) in zip(samples, samples[1:]))
+
+
+def energest_energy(lines, started, ended):
+    """Joules estimated from the first and last Energest print-out between started and ended."""
+    readings = [(line["t"], ENERGEST_RE.search(line["line"])) for line in lines
+                if started <= line["t"] <= ended]
+    readings = [(t, match) for t, match in readings if match]
+    if len(readings) < 2:
+        return None, 0
+    (t0, first), (t1, last) = readings[0], readings[-1]
+    second = int(last.group(2))
+    joules = 0.0
+    for group, state in enumerate(("cpu", "lpm", "tx", "rx"), start=3):
+        seconds = (int(last.group(group)) - int(first.group(group))) / second
+        joules += seconds * CURRENTS[state] / 1000 * VOLTAGE
+    return joules, t1 - t0
+
+
+def percentile(values, p):
+    if not values:
+        return None
+    values = sorted(values)
+    return values[min(len(values) - 1, int(p / 100 * len(values)))]
+
+
+def report(out):
+    with open(os.path.join(out, "run.json")) as f:
+        info = json.load(f)
+    started, ended = info["started"], info["ended"]
+    moving = [phase for phase in info["phases"] if phase["moving"]]
+    results = {}
+    for name, node in info["nodes"].items():
+        with open(os.path.join(out, f"serial.{name}.jsonl")) as f:
+            lines = [json.loads(line) for line in f]
+        changes = [(line["t"], match.group(1)) for line in lines if started <= line["t"] <= ended
+                   for match in [STATUS_RE.search(line["line"])] if match]
+
+        joules = oml_energy(info["experiment"], node, started, ended)
+        source, hours = "oml", (ended - started) / 3600
+        if joules is None:
+            joules, seconds = energest_energy(lines, started, ended)
+            source, hours = "energest", seconds / 3600
+        notifications = {}
+        for _, alarm in changes:
+            notifications[alarm] = notifications.get(alarm, 0) + 1
+
+        latencies = {}
+        for i, phase in enumerate(moving):
+            phase_end = moving[i + 1]["t"] if i + 1 < len(moving) else ended
+            for alarm in sorted(set(notifications)):
+                first = next((t for t, a in changes if a == alarm and phase["t"] <= t < phase_end), None)
+                if first is not None:
+                    latencies.setdefault(alarm, []).append(first - phase["t"])
+        results[name] = {
+            "node": node,
+            "energy_source": source,
+            "energy_j_per_h": joules / hours if joules is not None and hours else None,
+            "notifications": notifications,
+            "latency_s": {alarm: {"p50": percentile(values, 50), "max": max(values), "phases": len(values)}
+                          for alarm, values in latencies.items()},
+        }
+
+    with open(os.path.join(out, "report.json"), "w") as f:
+        json.dump(results, f, indent=2)
+    print(f"{len(info['phases'])} phases ({len(moving)} moving) over {(ended - started) / 60:.0f} min, seed {info['seed']}")
+    for name, result in results.items():
+        energy = result["energy_j_per_h"]
+        print(f"{name:<10} node m3-{result['node']}: "
+              + (f"{energy:.1f} J/h ({result['energy_source']})" if energy is not None else "no energy data"))
+        for alarm, count in sorted(result["notifications"].items()):
+            latency = result["latency_s"].get(alarm)
+            print(f"  {alarm:<10}{count:>6} notifications"
+                  + (f", latency p50 {latency['p50']:.1f} s, max {latency['max']:.1f} s" if latency else ""))
+    energies = [results[name]["energy_j_per_h"] for name in VARIANTS]
+    if None not in energies:
+        print(f"optimized - baseline: {energies[0] - energies[1]:+.1f} J/h ({energies[0] / energies[1] - 1:+.1%})")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--nodes", help="M3 ids of the optimized and baseline node, e.g. 101,102")
+    parser.add_argument("--site", default=os.environ.get("SITE", "grenoble"))
+    parser.add_argument("--seed", type=int, default=1, help="sensor traces and workload")
+    parser.add_argument("--duration", type=float, default=3600, help="seconds of workload")
+    parser.add_argument("--min-phase", type=float, default=30, help="shortest phase, seconds")
+    parser.add_argument("--max-phase", type=float, default=300, help="longest phase, seconds")
+    parser.add_argument("--out", default="alarm-ab", help="firmwares, serial logs and report")
+    parser.add_argument("--skip-build", action="store_true", help="reuse the firmwares in --out")
+    parser.add_argument("--report", metavar="DIR", help="only recompute the report of a previous run")
+    args = parser.parse_args()
+
+    if args.report:
+        report(args.report)
+    elif args.nodes:
+        benchmark(args)
+    else:
+        parser.error("--nodes or --report is required")
+
+
+if __name__ == "__main__":
+    main()
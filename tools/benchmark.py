@@ -0,0 +1,273 @@
+#!/usr/bin/env python3
+"""
+End-to-end throughput benchmark of the gateway pipelines against
+tools/thingsboard-mock.py, without motes, IoT-LAB or ThingsBoard.
+
+Each pipeline runs for --duration seconds with its own HOME (spool) and
+reports, from the mock's arrival records:
+  samples/s   key/value samples received per second, over the whole run
+  latency     arrival minus sample timestamp (p50/p95/p99), for timestamped samples
+  loss        samples produced before the last --grace seconds that never arrived
+
+Pipelines:
+  client             client.py polling the mock's fake node on [::1]
+  forward            forward_monitoring_data.py tailing generated .oml files
+  post-sensor-data   post-sensor-data.sh polling the fake node (HTTP only)
+  poller             tools/poller (make poller) polling the fake node (HTTP only)
+"""
+import argparse
+import json
+import os
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+MOCK = os.path.join(ROOT, "tools", "thingsboard-mock.py")
+POLLER = os.path.join(ROOT, "tools", "poller")
+HTTP_PORT, MQTT_PORT, NODE_PORT = 18080, 11883, 5683
+
+OML_HEADER = ("protocol: 4\ndomain: 1\nstart-time: {start}\nsender-id: node\napp-name: control_node_measures\n"
+              "schema: 0 _experiment_metadata subject:string key:string value:string\n"
+              "schema: 1 control_node_measures_consumption timestamp_s:uint32 timestamp_us:uint32 "
+              "power:double voltage:double current:double\ncontent: text\n\n")
+
+
+def wait_for_port(port, timeout=10):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(("127.0.0.1", port), timeout=1).close()
+            return
+        except OSError:
+            time.sleep(0.1)
+    raise RuntimeError(f"mock did not open port {port}")
+
+
+def stop(process, timeout=15):
+    """SIGINT first, so the pipeline can flush, then kill."""
+    if process.poll() is None:
+        process.send_signal(signal.SIGINT)
+        try:
+            process.wait(timeout)
+        except subprocess.TimeoutExpired:
+            process.kill()
+            process.wait()
+
+
+def percentile(values, p):
+    if not values:
+        return float("nan")
+    values = sorted(values)
+    return values[min(len(values) - 1, int(p / 100 * len(values)))]
+
+
+# FORWARD PIPELINE FIXTURES ===================================================
+
+
+def fake_iotlab(home, nodes):
+    """iotlab-experiment stand-in and empty .oml files, as the IoT-LAB frontend would have them."""
+    bin_dir = os.path.join(home, "bin")
+    os.makedirs(bin_dir)
+    script = os.path.join(bin_dir, "iotlab-experiment")
+    info = {"id": 1, "nodes": [f"{node.replace('_', '-')}.grenoble.iot-lab.info" for node in nodes]}
+    with open(script, "w") as f:
+        f.write(f"#!/bin/sh\necho '{json.dumps(info)}'\n")
+    os.chmod(script, 0o755)
+
+    paths = {}
+    for monitoring_type in ("consumption", "radio"):
+        os.makedirs(os.path.join(home, ".iot-lab", "1", monitoring_type))
+        for node in nodes:
+            path = os.path.join(home, ".iot-lab", "1", monitoring_type, f"{node}.oml")
+            with open(path, "w") as f:
+                f.write(OML_HEADER.format(start=int(time.time())))
+            paths[(monitoring_type, node)] = path
+    return bin_dir, paths
+
+
+class OmlWriter(threading.Thread):
+    """Appends consumption datapoints at a fixed rate, remembers what it wrote."""
+
+    def __init__(self, paths, nodes, rate):
+        super().__init__(daemon=True)
+        self.files = {node: open(paths[("consumption", node)], "a") for node in nodes}
+        self.radio_files = {node: open(paths[("radio", node)], "a") for node in nodes}
+        self.rate = rate
+        self.written = []  # (key, ts ms, written at)
+        self.running = True
+
+    def run(self):
+        start = time.time()
+        seq = 0
+        while self.running:
+            now = time.time()
+            for node, f in self.files.items():
+                sec, usec = int(now), int(now % 1 * 1e6)
+                f.write(f"{now - start:.6f}\t1\t{seq}\t{sec}\t{usec:06d}\t0.28\t3.28\t0.09\n")
+                f.flush()
+                self.written.append((f"power-{node}", sec * 1000 + usec // 1000, now))
+                self.radio_files[node].write(f"{now - start:.6f}\t2\t{seq}\t{sec}\t{usec:06d}\t{11 + seq % 2}\t-91\n")
+                self.radio_files[node].flush()
+            seq += 1
+            time.sleep(1 / self.rate)
+
+
+# BENCHMARK ===================================================================
+
+
+def load_arrivals(path):
+    arrivals = []
+    if os.path.exists(path):
+        with open(path) as f:
+            for line in f:
+                try:
+                    arrivals.append(json.loads(line))
+                except ValueError:
+                    pass  # last line of a killed mock
+    return arrivals
+
+
+def run_pipeline(name, args):
+    tmp = tempfile.mkdtemp(prefix=f"gin206-bench-{name}-")
+    home = os.path.join(tmp, "home")
+    os.makedirs(home)
+    record = os.path.join(tmp, "arrivals.jsonl")
+
+    mock = subprocess.Popen([sys.executable, MOCK, "--record", record, "--http-port", str(HTTP_PORT),
+                             "--mqtt-port", str(MQTT_PORT), "--coap-port", "0",
+                             "--node-port", str(NODE_PORT if name != "forward" else 0)],
+                            stderr=subprocess.DEVNULL)
+    writer = None
+    try:
+        wait_for_port(HTTP_PORT)
+        url = f"mqtt://127.0.0.1:{MQTT_PORT}" if args.transport == "mqtt" else f"http://127.0.0.1:{HTTP_PORT}"
+        env = dict(os.environ, HOME=home, THINGSBOARD_URL=url, SENSOR_SERVER="::1")
+        if name == "client":
+            command = [sys.executable, "client.py"]
+        elif name == "forward":
+            nodes = [f"m3_{i}" for i in range(1, args.nodes + 1)]
+            bin_dir, paths = fake_iotlab(home, nodes)
+            env["PATH"] = bin_dir + os.pathsep + env["PATH"]
+            env["FORWARD_AGGREGATE_MS"] = str(args.aggregate_ms)
+            writer = OmlWriter(paths, nodes, args.oml_rate)
+            writer.start()
+            command = [sys.executable, "forward_monitoring_data.py"]
+        elif name == "poller":
+            env["POLL_PERIOD_MS"] = str(args.poll_period_ms)
+            command = [POLLER]
+        else:
+            command = ["sh", "post-sensor-data.sh"]
+
+        started = time.time()
+        pipeline = subprocess.Popen(command, cwd=ROOT, env=env,
+                                    stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        time.sleep(args.duration)
+        if writer is not None:
+            writer.running = False
+        stop(pipeline)
+        ended = time.time()
+    finally:
+        stop(mock)
+        if writer is not None:
+            writer.running = False
+
+    arrivals = load_arrivals(record)
+    received = [a for a in arrivals if a["transport"] != "node"]
+    cutoff = ended - args.grace
+    if writer is not None and args.aggregate_ms:
+        # every window with a datapoint must arrive, as one power_max sample
+        produced = {(key.replace("power-", "power_max-"), ts - ts % args.aggregate_ms)
+                    for key, ts, at in writer.written if at < cutoff}
+        arrived = {(a["key"], a["ts"]) for a in received}
+    elif writer is not None:
+        produced = {(key, ts) for key, ts, at in writer.written if at < cutoff}
+        arrived = {(a["key"], a["ts"]) for a in received}
+    else:
+        produced = {(a["key"], float(a["value"])) for a in arrivals
+                    if a["transport"] == "node" and a["arrival"] / 1000 < cutoff}
+        arrived = {(a["key"], float(a["value"])) for a in received}
+    latencies = [(a["arrival"] - a["ts"]) / 1000 for a in received if a["ts"] is not None]
+
+    if not args.keep:
+        shutil.rmtree(tmp, ignore_errors=True)
+    return {
+        "pipeline": name,
+        "transport": args.transport,
+        "samples": len(received),
+        "samples_per_s": len(received) / (ended - started),
+        "latency_p50": percentile(latencies, 50),
+        "latency_p95": percentile(latencies, 95),
+        "latency_p99": percentile(latencies, 99),
+        "produced": len(produced),
+        "loss": len(produced - arrived) / len(produced) if produced else float("nan"),
+    }
+
+
+def available(name, args):
+    """Returns why a pipeline cannot run here, None if it can."""
+    if name == "client":
+        try:
+            import aiocoap  # noqa: F401
+        except ImportError:
+            return "aiocoap is not installed"
+    if name == "poller":
+        if args.transport != "http":
+            return "HTTP only"
+        if not os.path.exists(POLLER):
+            return "not built, run make poller"
+    if name == "post-sensor-data":
+        if args.transport != "http":
+            return "posts with curl, HTTP only"
+        if shutil.which("aiocoap-client") is None:
+            return "aiocoap-client is not installed"
+    if args.transport == "mqtt" and name in ("client", "forward"):
+        try:
+            import paho.mqtt.client  # noqa: F401
+        except ImportError:
+            return "paho-mqtt is not installed"
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("pipelines", nargs="*", default=["client", "forward", "post-sensor-data", "poller"])
+    parser.add_argument("--duration", type=float, default=60, help="seconds each pipeline runs")
+    parser.add_argument("--grace", type=float, default=15,
+                        help="samples produced in the last seconds do not count as lost")
+    parser.add_argument("--transport", choices=["http", "mqtt"], default="http")
+    parser.add_argument("--nodes", type=int, default=2, help="forward: monitored nodes")
+    parser.add_argument("--oml-rate", type=float, default=100, help="forward: datapoints per second and node")
+    parser.add_argument("--aggregate-ms", type=int, default=0,
+                        help="forward: aggregation window (FORWARD_AGGREGATE_MS), 0 forwards every datapoint")
+    parser.add_argument("--poll-period-ms", type=int, default=1000,
+                        help="poller: period of each sensor, 0 polls as fast as the node answers")
+    parser.add_argument("--json", action="store_true", help="print results as JSON lines")
+    parser.add_argument("--keep", action="store_true", help="keep the temporary directories")
+    args = parser.parse_args()
+
+    if not args.json:
+        print(f"{'pipeline':<18}{'transport':<10}{'samples':>9}{'samples/s':>11}"
+              f"{'p50 s':>8}{'p95 s':>8}{'p99 s':>8}{'loss':>8}")
+    for name in args.pipelines:
+        reason = available(name, args)
+        if reason is not None:
+            print(f"{name:<18}skipped: {reason}", file=sys.stderr)
+            continue
+        result = run_pipeline(name, args)
+        if args.json:
+            print(json.dumps(result))
+        else:
+            print(f"{name:<18}{args.transport:<10}{result['samples']:>9}{result['samples_per_s']:>11.1f}"
+                  f"{result['latency_p50']:>8.2f}{result['latency_p95']:>8.2f}{result['latency_p99']:>8.2f}"
+                  f"{result['loss']:>8.1%}")
+
+
+if __name__ == "__main__":
+    main()
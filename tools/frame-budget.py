@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+"""
+Worst-case 802.15.4 frame size of every CoAP exchange of the resource server.
+
+Reads the resources and paths from resources/resource-table.h and
+REST_MAX_CHUNK_SIZE from project-conf.h, estimates request and response
+frame sizes and flags any exchange that does not fit into a single
+127-byte frame, i.e. would need 6LoWPAN fragmentation.
+Exits with status 1 if any exchange is flagged.
+
+Usage: python3 tools/frame-budget.py [--direct-telemetry] [--chunk-size N]
+"""
+import argparse
+import os
+import re
+import sys
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+# 802.15.4 ====================================================================
+
+FRAME_SIZE = 127
+# FCF (2) + sequence (1) + PAN ID (2) + long destination and source (8 + 8) + FCS (2)
+MAC_OVERHEAD = 23
+
+# 6LoWPAN / IPv6 / UDP ========================================================
+
+# IPHC base (2) + inline hop limit (1)
+IPHC_BASE = 3
+# The remote end (gateway or ThingsBoard) is outside the mesh prefix, so its
+# address is carried inline; the node address is derived from context and MAC.
+IPHC_ADDRESSES = 16
+# RPL hop-by-hop option (RPI) in storing mode
+RPL_OPTION = 8
+# UDP NHC (1) + ports inline (4) + checksum (2)
+UDP_NHC = 7
+
+LOWPAN_OVERHEAD = IPHC_BASE + IPHC_ADDRESSES + RPL_OPTION + UDP_NHC
+COAP_BUDGET = FRAME_SIZE - MAC_OVERHEAD - LOWPAN_OVERHEAD
+
+# CoAP ========================================================================
+
+COAP_HEADER = 4
+# aiocoap may use tokens of up to 8 bytes
+TOKEN_MAX = 8
+PAYLOAD_MARKER = 1
+# Observe with a 3-byte sequence number
+OBSERVE_OPTION = 1 + 3
+# Content-Format with a 1-byte value (text/plain is 0 bytes, json 1 byte)
+CONTENT_FORMAT_OPTION = 1 + 1
+# Max-Age 60
+MAX_AGE_OPTION = 1 + 1
+# Accept application/json, for timestamped samples
+ACCEPT_OPTION = 1 + 1
+# Block2 with a 1-byte block number, for SenML packs served in blocks
+BLOCK2_OPTION = 1 + 1
+# 1-byte ETag of the alarms and of every block of a SenML pack
+ETAG_OPTION = 1 + 1
+# COAP_PIPELINE_TOKEN_LEN, the token of the node's own requests (coap-pipeline.h)
+PIPELINE_TOKEN = 2
+
+
+def option_size(delta, length):
+    """Size of one CoAP option, including extended delta/length bytes."""
+    size = 1 + length
+    for value in (delta, length):
+        if value >= 269:
+            size += 2
+        elif value >= 13:
+            size += 1
+    return size
+
+
+def uri_path_size(path, first_delta=11):
+    """Uri-Path (option 11) bytes for a path, one option per segment."""
+    size = 0
+    delta = first_delta
+    for segment in path.strip("/").split("/"):
+        size += option_size(delta, len(segment))
+        delta = 0
+    return size
+
+
+def read_chunk_size():
+    with open(os.path.join(ROOT, "project-conf.h")) as f:
+        match = re.search(r"#define\s+REST_MAX_CHUNK_SIZE\s+(\d+)", f.read())
+    return int(match.group(1))
+
+
+def read_resource_table():
+    """List of (kind, resource, path, max_payload) from resources/resource-table.h."""
+    with open(os.path.join(ROOT, "resources", "resource-table.h")) as f:
+        content = f.read()
+    entries = re.findall(
+        r"RESOURCE_(ENTRY|ALIAS)\((\w+),\s*\"([^\"]+)\",\s*(\d+)\)", content)
+    return [(kind.lower(), res, path, int(max_payload))
+            for kind, res, path, max_payload in entries]
+
+
+def read_telemetry_conf(token=None, payload_max=None):
+    """(URL path, largest payload) of the direct telemetry POSTs, defaults from direct-telemetry.h."""
+    with open(os.path.join(ROOT, "direct-telemetry.h")) as f:
+        content = f.read()
+    token = token or re.search(r"#define\s+DIRECT_TELEMETRY_TOKEN\s+\"([^\"]+)\"", content).group(1)
+    payload_max = payload_max or int(re.search(r"#define\s+DIRECT_TELEMETRY_PAYLOAD_MAX\s+(\d+)", content).group(1))
+    return f"api/v1/{token}/telemetry", payload_max
+
+
+def exchanges(chunk_size, direct_telemetry, telemetry_token=None, telemetry_payload_max=None):
+    """Yields (name, path, direction, coap_bytes) for every exchange."""
+    for kind, res, path, max_payload in read_resource_table():
+        name = f"{res} ({kind})"
+        # GET (with Observe registration, Accept and Block2) from the gateway
+        request = COAP_HEADER + TOKEN_MAX + OBSERVE_OPTION + uri_path_size(path) + ACCEPT_OPTION + BLOCK2_OPTION
+        yield name, path, "request", request
+        # Response or notification: no Uri-Path, but ETag, Observe, Content-Format, Max-Age, Block2
+        payload = min(max_payload, chunk_size)
+        response = (COAP_HEADER + TOKEN_MAX + ETAG_OPTION + OBSERVE_OPTION + CONTENT_FORMAT_OPTION
+                    + MAX_AGE_OPTION + BLOCK2_OPTION + PAYLOAD_MARKER + payload)
+        yield name, path, "response", response
+
+    if direct_telemetry:
+        # Telemetry POSTs go through coap-pipeline, their payload is bounded on its own
+        path, payload_max = read_telemetry_conf(telemetry_token, telemetry_payload_max)
+        request = (COAP_HEADER + PIPELINE_TOKEN + uri_path_size(path)
+                   + option_size(1, 1) + PAYLOAD_MARKER + min(payload_max, chunk_size))
+        yield "direct telemetry", path, "uplink", request
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("--chunk-size", type=int, default=None,
+                        help="REST_MAX_CHUNK_SIZE (default: from project-conf.h)")
+    parser.add_argument("--direct-telemetry", action="store_true",
+                        help="also check the direct ThingsBoard uplink")
+    parser.add_argument("--telemetry-token", help="DIRECT_TELEMETRY_TOKEN (default: from direct-telemetry.h)")
+    parser.add_argument("--telemetry-payload-max", type=int,
+                        help="DIRECT_TELEMETRY_PAYLOAD_MAX (default: from direct-telemetry.h)")
+    args = parser.parse_args()
+
+    chunk_size = args.chunk_size or read_chunk_size()
+    print(f"Frame {FRAME_SIZE} B - MAC {MAC_OVERHEAD} B - 6LoWPAN/UDP {LOWPAN_OVERHEAD} B"
+          f" = {COAP_BUDGET} B for CoAP (REST_MAX_CHUNK_SIZE {chunk_size})")
+    print(f"{'resource':<34} {'path':<28} {'exchange':<9} {'CoAP':>5} {'frame':>6} {'margin':>7}")
+
+    fragmented = 0
+    for name, path, direction, coap_bytes in exchanges(chunk_size, args.direct_telemetry,
+                                                       args.telemetry_token, args.telemetry_payload_max):
+        frame = MAC_OVERHEAD + LOWPAN_OVERHEAD + coap_bytes
+        margin = FRAME_SIZE - frame
+        flag = "" if margin >= 0 else "  FRAGMENTS"
+        fragmented += margin < 0
+        print(f"{name:<34} {path:<28} {direction:<9} {coap_bytes:>5} {frame:>6} {margin:>7}{flag}")
+
+    if fragmented:
+        print(f"{fragmented} exchange(s) need 6LoWPAN fragmentation")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+"""
+Static RAM/flash budget of a Contiki image.
+
+Takes the image totals from its sections (size -A), reads symbol sizes
+from the linked image with nm, attributes each symbol to the object file
+(module) that defines it, and prints a per-module and per-symbol
+breakdown. Symbols are keyed by module and name, so same-named statics of
+different modules are counted separately. The result can be stored as a
+baseline and later images diffed against it. Exits with status 1 if a RAM
+or flash budget is exceeded.
+
+Usage:
+  python3 tools/mem-budget.py IMAGE --objdir obj_iotlab-m3 [--lib contiki-iotlab-m3.a]
+      [--conf project-conf.h] [--baseline FILE] [--save-baseline]
+      [--ram-budget BYTES] [--flash-budget BYTES] [--top N]
+"""
+import argparse
+import glob
+import json
+import os
+import re
+import subprocess
+import sys
+
+# nm symbol types: text and read-only data live in flash, initialized data
+# in both (flash image copied to RAM at boot), bss only in RAM.
+FLASH_TYPES = set("tTrRvVwW")
+DATA_TYPES = set("dDgG")
+BSS_TYPES = set("bBsScC")
+
+# size -A sections: initialized data is in both memories, these only in RAM;
+# the others with an address are in flash, the rest (debug info) in neither
+DATA_SECTIONS = (".data",)
+BSS_SECTIONS = (".bss", ".noinit", ".stack", ".heap", "COMMON")
+UNLOADED_SECTIONS = (".debug", ".comment", ".ARM.attributes", ".stab")
+
+
+def run(tool, *args):
+    return subprocess.run([tool, *args], check=True, capture_output=True, text=True).stdout
+
+
+def read_image_symbols(nm, image):
+    """
+    List of (name, type, size, module) of the sized symbols of the linked image.
+    module is the object file of the source the debug info names (nm -l), None without it.
+    """
+    symbols = []
+    for line in run(nm, "-S", "-l", "--size-sort", "-t", "d", image).splitlines():
+        symbol, _, location = line.partition("\t")
+        fields = symbol.split()
+        if len(fields) != 4:
+            continue
+        _, size, sym_type, name = fields
+        module = None
+        source = os.path.basename(location.rsplit(":", 1)[0])
+        if source.endswith(".c"):
+            module = source[:-2] + ".o"
+        symbols.append((name, sym_type, int(size), module))
+    return symbols
+
+
+def read_object_symbols(nm, objects):
+    """Dict symbol name -> list of (module, size) of the objects defining it, statics included."""
+    definitions = {}
+    for path in objects:
+        module = os.path.basename(path)
+        for line in run(nm, "-S", "-t", "d", "--defined-only", path).splitlines():
+            # archives list their members as "member.o:"
+            if line.endswith(".o:"):
+                module = line[:-1]
+                continue
+            fields = line.split()
+            if len(fields) == 4:
+                definitions.setdefault(fields[3], []).append((module, int(fields[1])))
+    return definitions
+
+
+def assign_modules(symbols, definitions):
+    """
+    Completes the modules nm -l did not find: a symbol goes to an object defining a
+    symbol of that name and size (then of that name), each definition used once.
+    """
+    remaining = {name: list(found) for name, found in definitions.items()}
+    assigned = []
+    for name, sym_type, size, module in symbols:
+        candidates = remaining.get(name, [])
+        if module is None and candidates:
+            match = next((c for c in candidates if c[1] == size), candidates[0])
+            candidates.remove(match)
+            module = match[0]
+        assigned.append((name, sym_type, size, module or "(unknown)"))
+    return assigned
+
+
+def read_section_totals(size_tool, image):
+    """Flash and RAM used by the image according to its sections (size -A)."""
+    total = {"flash": 0, "ram": 0}
+    for line in run(size_tool, "-A", "-d", image).splitlines():
+        fields = line.split()
+        if len(fields) != 3 or not fields[1].isdigit() or not fields[2].isdigit():
+            continue
+        name, size, address = fields[0], int(fields[1]), int(fields[2])
+        if address == 0 or name.startswith(UNLOADED_SECTIONS):
+            continue
+        if name.startswith(DATA_SECTIONS):
+            total["flash"] += size
+            total["ram"] += size
+        elif name.startswith(BSS_SECTIONS):
+            total["ram"] += size
+        else:
+            total["flash"] += size
+    return total
+
+
+def read_conf(paths):
+    """Numeric #defines of the project configuration, e.g. COAP_MAX_OPEN_TRANSACTIONS."""
+    conf = {}
+    for path in paths:
+        with open(path) as f:
+            # skip commented-out settings
+            content = re.sub(r"/\*.*?\*/", "", f.read(), flags=re.S)
+            for name, value in re.findall(r"^\s*#define\s+(\w+)\s+(\d+)\s*$", content, re.M):
+                conf[name] = int(value)
+    return conf
+
+
+def breakdown(symbols, total):
+    result = {"total": total, "modules": {}, "symbols": {}}
+    for name, sym_type, size, module in symbols:
+        if sym_type in FLASH_TYPES:
+            flash, ram = size, 0
+        elif sym_type in DATA_TYPES:
+            flash, ram = size, size
+        elif sym_type in BSS_TYPES:
+            flash, ram = 0, size
+        else:
+            continue
+        entry = result["modules"].setdefault(module, {"flash": 0, "ram": 0})
+        entry["flash"] += flash
+        entry["ram"] += ram
+        entry = result["symbols"].setdefault(f"{module}:{name}", {"module": module, "flash": 0, "ram": 0})
+        entry["flash"] += flash
+        entry["ram"] += ram
+    return result
+
+
+def delta(current, baseline):
+    if baseline is None:
+        return ""
+    diff = current - baseline
+    return f"{diff:+d}" if diff else ""
+
+
+def print_table(title, rows, baseline_rows, top):
+    print(f"\n{title}")
+    print(f"{'':<40} {'RAM':>7} {'diff':>7} {'flash':>7} {'diff':>7}")
+    ordered = sorted(rows.items(), key=lambda item: (item[1]["ram"], item[1]["flash"]), reverse=True)
+    for name, sizes in ordered[:top]:
+        base = baseline_rows.get(name, {"ram": 0, "flash": 0}) if baseline_rows is not None else None
+        print(f"{name[:40]:<40} {sizes['ram']:>7} {delta(sizes['ram'], base and base['ram']):>7}"
+              f" {sizes['flash']:>7} {delta(sizes['flash'], base and base['flash']):>7}")
+    if baseline_rows is not None:
+        for name in sorted(set(baseline_rows) - set(rows)):
+            print(f"{name[:40]:<40} {'gone':>7} {-baseline_rows[name]['ram']:>+7}"
+                  f" {'':>7} {-baseline_rows[name]['flash']:>+7}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("image", help="linked image (ELF), e.g. resource-server.iotlab-m3")
+    parser.add_argument("--objdir", help="directory with the project object files")
+    parser.add_argument("--lib", action="append", default=[], help="Contiki library archive")
+    parser.add_argument("--conf", action="append", default=[], help="configuration header to record")
+    parser.add_argument("--nm", default=os.environ.get("NM", "nm"))
+    parser.add_argument("--size", default=os.environ.get("SIZE", "size"))
+    parser.add_argument("--baseline", help="stored baseline (JSON)")
+    parser.add_argument("--save-baseline", action="store_true", help="write the baseline instead of diffing")
+    parser.add_argument("--ram-budget", type=int)
+    parser.add_argument("--flash-budget", type=int)
+    parser.add_argument("--top", type=int, default=20, help="number of symbols listed")
+    args = parser.parse_args()
+
+    objects = list(args.lib)
+    if args.objdir:
+        objects += sorted(glob.glob(os.path.join(args.objdir, "*.o")))
+
+    symbols = assign_modules(read_image_symbols(args.nm, args.image), read_object_symbols(args.nm, objects))
+    result = breakdown(symbols, read_section_totals(args.size, args.image))
+    result["conf"] = read_conf(args.conf)
+
+    if args.save_baseline:
+        os.makedirs(os.path.dirname(args.baseline) or ".", exist_ok=True)
+        with open(args.baseline, "w") as f:
+            json.dump(result, f, indent=1, sort_keys=True)
+        print(f"Baseline written to {args.baseline}")
+
+    baseline = None
+    if args.baseline and not args.save_baseline:
+        if os.path.exists(args.baseline):
+            with open(args.baseline) as f:
+                baseline = json.load(f)
+        else:
+            print(f"No baseline at {args.baseline}, run with --save-baseline first")
+
+    total, base_total = result["total"], baseline and baseline["total"]
+    print(f"{args.image}: RAM {total['ram']} B {delta(total['ram'], base_total and base_total['ram'])}"
+          f", flash {total['flash']} B {delta(total['flash'], base_total and base_total['flash'])}")
+    for name, value in sorted(result["conf"].items()):
+        old = baseline["conf"].get(name) if baseline else None
+        changed = f" (was {old})" if old is not None and old != value else ""
+        print(f"  {name} = {value}{changed}")
+
+    print_table("Modules", result["modules"], baseline and baseline["modules"], len(result["modules"]))
+    print_table("Symbols", result["symbols"], None, args.top)
+
+    exceeded = False
+    if args.ram_budget is not None and total["ram"] > args.ram_budget:
+        print(f"RAM budget exceeded: {total['ram']} > {args.ram_budget} B")
+        exceeded = True
+    if args.flash_budget is not None and total["flash"] > args.flash_budget:
+        print(f"Flash budget exceeded: {total['flash']} > {args.flash_budget} B")
+        exceeded = True
+    if exceeded:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
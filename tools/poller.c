@@ -0,0 +1,825 @@
+/**
+ * \file
+ *      Native replacement of post-sensor-data.sh: one long-running process that
+ *      polls the sensors of one or more resource servers over CoAP and uploads
+ *      the samples in timestamped batches over a persistent HTTP connection.
+ *
+ *      Configuration (environment):
+ *        SENSOR_SERVER    IPv6 address(es) of the resource server(s), comma-separated
+ *        DEVICE_TOKEN     ThingsBoard device token (MONITOKEN)
+ *        THINGSBOARD_URL  http://host[:port] (http://mauro.rezel.net:8080)
+ *        POLL_PERIOD_MS   period of each sensor, 0 polls again as soon as it answered (1000)
+ *        SENSOR_PATHS     path=key pairs (s/l=light,s/t=temperature,s/r=rain)
+ *        NSTART           outstanding requests per node (1, RFC 7252 section 4.7)
+ *        MAX_BATCH        samples per upload (500)
+ *
+ *      The uploads run on their own thread, so a slow backend does not hold up
+ *      the polls. Build with `make poller`, stop with Ctrl-C (pending samples
+ *      are uploaded first).
+ */
+
+#define _GNU_SOURCE /* strcasestr, memmem */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define COAP_PORT              5683
+#define COAP_ACK_TIMEOUT_MS    2000
+#define COAP_MAX_RETRANSMIT    4
+#define COAP_TYPE_CON          0
+#define COAP_TYPE_ACK          2
+#define COAP_TYPE_RST          3
+#define COAP_GET               1
+#define COAP_CONTENT           0x45
+#define COAP_OPTION_URI_PATH   11
+
+#define MAX_NODES              256
+#define MAX_RESOURCES          16
+#define MAX_PATH               32
+#define MAX_KEY                32
+#define FLUSH_MS               1000
+#define HTTP_TIMEOUT_MS        10000
+#define MIN_RETRY_MS           1000
+#define MAX_RETRY_MS           60000
+/* Samples kept while the backend is unreachable, the oldest are dropped beyond */
+#define MAX_PENDING            100000
+
+struct resource {
+  char path[MAX_PATH];
+  char key[MAX_KEY];
+};
+
+struct node {
+  struct sockaddr_in6 addr;
+  char suffix[8];
+  int in_flight;
+  /* next_due() scans from here, so ties go round-robin */
+  int next_resource;
+};
+
+enum { POLL_IDLE, POLL_IN_FLIGHT };
+
+struct poll_state {
+  int node;
+  int resource;
+  int state;
+  uint64_t next_ms;
+  uint64_t timeout_at;
+  uint32_t timeout_ms;
+  int retransmits;
+  uint16_t mid;
+  uint16_t generation;
+  uint8_t msg[64];
+  size_t msg_len;
+};
+
+static struct resource resources[MAX_RESOURCES];
+static int resource_count;
+static struct node nodes[MAX_NODES];
+static int node_count;
+static struct poll_state *polls;
+static int poll_count;
+
+static int udp_fd = -1;
+static int http_fd = -1;
+static char http_host[256];
+static char http_port[8];
+static char http_path[256];
+
+static uint64_t period_ms;
+static int nstart;
+static int max_batch;
+static uint16_t next_mid;
+static volatile sig_atomic_t running = 1;
+
+/* JSON array of {"ts":..,"values":{..}}, without the closing bracket */
+struct batch {
+  char *data;
+  size_t len;
+  size_t size;
+  int samples;
+  uint64_t started;
+};
+
+/* Filled by the CoAP loop, taken over by the upload thread, both under batch_lock */
+static struct batch batch;
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batch_cond;
+static int stopping;
+
+static unsigned long stat_samples, stat_timeouts, stat_errors, stat_uploads, stat_dropped;
+/*---------------------------------------------------------------------------*/
+static uint64_t
+now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/*---------------------------------------------------------------------------*/
+static uint64_t
+epoch_ms(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+/*---------------------------------------------------------------------------*/
+static const char *
+env_or(const char *name, const char *fallback)
+{
+  const char *value = getenv(name);
+  return value != NULL && value[0] != '\0' ? value : fallback;
+}
+/*---------------------------------------------------------------------------*/
+static void
+stop(int signum)
+{
+  (void)signum;
+  running = 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+parse_nodes(const char *list)
+{
+  char copy[4096];
+  char *address, *save;
+  int multiple = strchr(list, ',') != NULL;
+
+  snprintf(copy, sizeof(copy), "%s", list);
+  for(address = strtok_r(copy, ", ", &save); address != NULL; address = strtok_r(NULL, ", ", &save)) {
+    struct node *node;
+    const char *last_group;
+
+    if(node_count == MAX_NODES) {
+      fprintf(stderr, "[poller] more than %d nodes\n", MAX_NODES);
+      return -1;
+    }
+    node = &nodes[node_count];
+    memset(&node->addr, 0, sizeof(node->addr));
+    node->addr.sin6_family = AF_INET6;
+    node->addr.sin6_port = htons(COAP_PORT);
+    if(inet_pton(AF_INET6, address, &node->addr.sin6_addr) != 1) {
+      fprintf(stderr, "[poller] not an IPv6 address: %s\n", address);
+      return -1;
+    }
+    /* several nodes share one device, the keys get the address' last group like in client.py */
+    last_group = strrchr(address, ':');
+    if(multiple) {
+      snprintf(node->suffix, sizeof(node->suffix), "-%s", last_group != NULL ? last_group + 1 : address);
+    }
+    node_count++;
+  }
+  return node_count > 0 ? 0 : -1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+parse_resources(const char *list)
+{
+  char copy[1024];
+  char *pair, *save;
+
+  snprintf(copy, sizeof(copy), "%s", list);
+  for(pair = strtok_r(copy, ",", &save); pair != NULL; pair = strtok_r(NULL, ",", &save)) {
+    char *key = strchr(pair, '=');
+    if(key == NULL || resource_count == MAX_RESOURCES) {
+      fprintf(stderr, "[poller] bad SENSOR_PATHS entry: %s\n", pair);
+      return -1;
+    }
+    *key++ = '\0';
+    snprintf(resources[resource_count].path, MAX_PATH, "%s", pair);
+    snprintf(resources[resource_count].key, MAX_KEY, "%s", key);
+    resource_count++;
+  }
+  return resource_count > 0 ? 0 : -1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+parse_url(const char *url, const char *token)
+{
+  const char *host = url, *end;
+  size_t host_len;
+
+  if(strncmp(host, "http://", 7) != 0) {
+    fprintf(stderr, "[poller] only http:// is supported: %s\n", url);
+    return -1;
+  }
+  host += 7;
+  if(*host == '[') {
+    end = strchr(++host, ']');
+    if(end == NULL) {
+      return -1;
+    }
+    host_len = end++ - host;
+  } else {
+    end = host + strcspn(host, ":/");
+    host_len = end - host;
+  }
+  snprintf(http_host, sizeof(http_host), "%.*s", (int)host_len, host);
+  if(*end == ':') {
+    snprintf(http_port, sizeof(http_port), "%.*s", (int)strcspn(end + 1, "/"), end + 1);
+  } else {
+    snprintf(http_port, sizeof(http_port), "80");
+  }
+  snprintf(http_path, sizeof(http_path), "/api/v1/%s/telemetry", token);
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* CoAP                                                                      */
+/*---------------------------------------------------------------------------*/
+static size_t
+coap_build_get(uint8_t *msg, uint16_t mid, const uint8_t *token, const char *path)
+{
+  size_t len = 0;
+  unsigned last = 0;
+  const char *segment = path;
+
+  msg[len++] = 0x40 | (COAP_TYPE_CON << 4) | 4;
+  msg[len++] = COAP_GET;
+  msg[len++] = mid >> 8;
+  msg[len++] = mid & 0xff;
+  memcpy(msg + len, token, 4);
+  len += 4;
+  while(*segment != '\0') {
+    size_t segment_len = strcspn(segment, "/");
+    /* paths are short (MAX_PATH): the delta fits the nibble, the length at most one extra byte */
+    if(segment_len < 13) {
+      msg[len++] = ((COAP_OPTION_URI_PATH - last) << 4) | segment_len;
+    } else {
+      msg[len++] = ((COAP_OPTION_URI_PATH - last) << 4) | 13;
+      msg[len++] = segment_len - 13;
+    }
+    memcpy(msg + len, segment, segment_len);
+    len += segment_len;
+    last = COAP_OPTION_URI_PATH;
+    segment += segment_len;
+    if(*segment == '/') {
+      segment++;
+    }
+  }
+  return len;
+}
+/*---------------------------------------------------------------------------*/
+static void
+coap_send(struct poll_state *p)
+{
+  sendto(udp_fd, p->msg, p->msg_len, 0, (struct sockaddr *)&nodes[p->node].addr, sizeof(nodes[p->node].addr));
+}
+/*---------------------------------------------------------------------------*/
+static void
+start_request(struct poll_state *p, uint64_t now)
+{
+  uint8_t token[4];
+  int index = (int)(p - polls);
+
+  p->generation++;
+  token[0] = index >> 8;
+  token[1] = index & 0xff;
+  token[2] = p->generation >> 8;
+  token[3] = p->generation & 0xff;
+  p->mid = next_mid++;
+  p->msg_len = coap_build_get(p->msg, p->mid, token, resources[p->resource].path);
+  p->state = POLL_IN_FLIGHT;
+  p->retransmits = 0;
+  p->timeout_ms = COAP_ACK_TIMEOUT_MS + rand() % (COAP_ACK_TIMEOUT_MS / 2);
+  p->timeout_at = now + p->timeout_ms;
+  nodes[p->node].in_flight++;
+  coap_send(p);
+}
+/*---------------------------------------------------------------------------*/
+static void
+finish_request(struct poll_state *p, uint64_t now)
+{
+  p->state = POLL_IDLE;
+  nodes[p->node].in_flight--;
+  /* keep the period start to start, but do not try to catch up after a stall */
+  p->next_ms += period_ms;
+  if(p->next_ms < now) {
+    p->next_ms = now;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* The idle poll of the node that has been due the longest, NULL if none is due:
+ * a node with a free slot starts it first, so with NSTART 1 no resource starves.
+ * Ties go to the first resource after the one started last. */
+static struct poll_state *
+next_due(int node, uint64_t now)
+{
+  struct poll_state *due = NULL;
+  int j;
+
+  for(j = 0; j < resource_count; j++) {
+    int resource = (nodes[node].next_resource + j) % resource_count;
+    struct poll_state *p = &polls[node * resource_count + resource];
+    if(p->state == POLL_IDLE && p->next_ms <= now && (due == NULL || p->next_ms < due->next_ms)) {
+      due = p;
+    }
+  }
+  if(due != NULL) {
+    nodes[node].next_resource = (due->resource + 1) % resource_count;
+  }
+  return due;
+}
+/*---------------------------------------------------------------------------*/
+static void add_sample(const struct poll_state *p, const uint8_t *payload, size_t len);
+
+static void
+coap_receive(uint64_t now)
+{
+  uint8_t buf[1500];
+  struct sockaddr_in6 from;
+  socklen_t from_len;
+  ssize_t len;
+
+  for(;;) {
+    size_t i;
+    unsigned tkl, type, code, index, generation;
+    struct poll_state *p;
+
+    from_len = sizeof(from);
+    len = recvfrom(udp_fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+    if(len < 4) {
+      return;
+    }
+    type = (buf[0] >> 4) & 3;
+    tkl = buf[0] & 0x0f;
+    code = buf[1];
+    if(tkl != 4 || len < 8) {
+      continue;
+    }
+    if(type == COAP_TYPE_CON) {
+      /* separate response: acknowledge it */
+      uint8_t ack[4] = { 0x40 | (COAP_TYPE_ACK << 4), 0, buf[2], buf[3] };
+      sendto(udp_fd, ack, sizeof(ack), 0, (struct sockaddr *)&from, from_len);
+    }
+    if(code == 0) {
+      continue; /* empty ACK, the response comes separately */
+    }
+    index = buf[4] << 8 | buf[5];
+    generation = buf[6] << 8 | buf[7];
+    if(index >= (unsigned)poll_count) {
+      continue;
+    }
+    p = &polls[index];
+    if(p->state != POLL_IN_FLIGHT || p->generation != generation) {
+      continue; /* duplicate, or answer to a request we gave up on */
+    }
+
+    /* skip options */
+    i = 8;
+    while(i < (size_t)len && buf[i] != 0xff) {
+      unsigned delta = buf[i] >> 4, opt_len = buf[i] & 0x0f;
+      i++;
+      if(delta == 13) {
+        i += 1;
+      } else if(delta == 14) {
+        i += 2;
+      }
+      if(opt_len == 13) {
+        opt_len = buf[i] + 13;
+        i += 1;
+      } else if(opt_len == 14) {
+        opt_len = (buf[i] << 8 | buf[i + 1]) + 269;
+        i += 2;
+      }
+      i += opt_len;
+    }
+    if(code == COAP_CONTENT && i < (size_t)len) {
+      add_sample(p, buf + i + 1, len - i - 1);
+    } else {
+      stat_errors++;
+    }
+    finish_request(p, now);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* HTTP                                                                      */
+/*---------------------------------------------------------------------------*/
+static void
+http_close(void)
+{
+  if(http_fd >= 0) {
+    close(http_fd);
+    http_fd = -1;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+http_connect(void)
+{
+  struct addrinfo hints, *result, *ai;
+  struct timeval timeout = { HTTP_TIMEOUT_MS / 1000, 0 };
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = SOCK_STREAM;
+  if(getaddrinfo(http_host, http_port, &hints, &result) != 0) {
+    return -1;
+  }
+  for(ai = result; ai != NULL; ai = ai->ai_next) {
+    http_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if(http_fd < 0) {
+      continue;
+    }
+    setsockopt(http_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(http_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if(connect(http_fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      break;
+    }
+    http_close();
+  }
+  freeaddrinfo(result);
+  return http_fd >= 0 ? 0 : -1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+write_all(const char *data, size_t len)
+{
+  while(len > 0) {
+    ssize_t n = send(http_fd, data, len, MSG_NOSIGNAL);
+    if(n < 0 && errno == EINTR) {
+      continue; /* interrupted by a signal: finish the upload */
+    }
+    if(n <= 0) {
+      return -1;
+    }
+    data += n;
+    len -= n;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* Reads one response, returns its status or -1; closes the connection if asked to. */
+static int
+http_read_response(void)
+{
+  char buf[4096];
+  size_t len = 0;
+  char *body;
+  long content_length = 0;
+  int status;
+
+  for(;;) {
+    ssize_t n = recv(http_fd, buf + len, sizeof(buf) - 1 - len, 0);
+    if(n < 0 && errno == EINTR) {
+      continue;
+    }
+    if(n <= 0) {
+      return -1;
+    }
+    len += n;
+    buf[len] = '\0';
+    body = strstr(buf, "\r\n\r\n");
+    if(body != NULL) {
+      break;
+    }
+    if(len == sizeof(buf) - 1) {
+      return -1;
+    }
+  }
+  body += 4;
+  if(sscanf(buf, "HTTP/%*s %d", &status) != 1) {
+    return -1;
+  }
+  {
+    char *header = strcasestr(buf, "\r\ncontent-length:");
+    if(header != NULL && header < body) {
+      content_length = strtol(header + 17, NULL, 10);
+    }
+  }
+  /* discard the body */
+  content_length -= (long)(buf + len - body);
+  while(content_length > 0) {
+    ssize_t n = recv(http_fd, buf, sizeof(buf), 0);
+    if(n < 0 && errno == EINTR) {
+      continue;
+    }
+    if(n <= 0) {
+      return -1;
+    }
+    content_length -= n;
+  }
+  {
+    char *header = strcasestr(buf, "\r\nconnection: close");
+    if(header != NULL && header < body) {
+      http_close();
+    }
+  }
+  return status;
+}
+/*---------------------------------------------------------------------------*/
+static int
+http_post(const char *body, size_t len)
+{
+  char header[512];
+  int header_len, attempt, status;
+
+  header_len = snprintf(header, sizeof(header),
+                        "POST %s HTTP/1.1\r\nHost: %s:%s\r\nContent-Type: application/json\r\n"
+                        "Content-Length: %zu\r\n\r\n", http_path, http_host, http_port, len);
+  /* a kept-alive connection may have been closed by the server meanwhile, so retry once */
+  for(attempt = 0; attempt < 2; attempt++) {
+    if(http_fd < 0 && http_connect() < 0) {
+      continue;
+    }
+    if(write_all(header, header_len) < 0 || write_all(body, len) < 0
+       || (status = http_read_response()) < 0) {
+      http_close();
+      continue;
+    }
+    return status >= 200 && status < 300 ? 0 : -1;
+  }
+  return -1;
+}
+/*---------------------------------------------------------------------------*/
+/* Batching                                                                  */
+/*---------------------------------------------------------------------------*/
+static void
+batch_append(struct batch *b, const char *data, size_t len)
+{
+  if(b->len + len + 2 > b->size) {
+    b->size = (b->len + len + 2) * 2;
+    b->data = realloc(b->data, b->size);
+    if(b->data == NULL) {
+      perror("[poller] realloc");
+      exit(1);
+    }
+  }
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+/*---------------------------------------------------------------------------*/
+/* Removes the count oldest samples; keys and values hold no "}},", only entry ends do. */
+static void
+batch_drop_oldest(struct batch *b, int count)
+{
+  size_t from = 1;
+  int dropped;
+
+  for(dropped = 0; dropped < count; dropped++) {
+    char *end = memmem(b->data + from, b->len - from, "}},", 3);
+    if(end == NULL) {
+      break;
+    }
+    from = end + 3 - b->data;
+  }
+  memmove(b->data + 1, b->data + from, b->len - from);
+  b->len -= from - 1;
+  b->samples -= dropped;
+  stat_dropped += dropped;
+}
+/*---------------------------------------------------------------------------*/
+static void
+add_sample(const struct poll_state *p, const uint8_t *payload, size_t len)
+{
+  char entry[256];
+  char value[32];
+  size_t i, value_len = 0;
+  int entry_len;
+
+  /* the value goes into the JSON as is, so only accept a number */
+  for(i = 0; i < len && value_len < sizeof(value) - 1; i++) {
+    if(strchr("0123456789.-+eE", payload[i]) == NULL || payload[i] == '\0') {
+      break;
+    }
+    value[value_len++] = payload[i];
+  }
+  value[value_len] = '\0';
+  if(value_len == 0 || i != len) {
+    stat_errors++;
+    return;
+  }
+
+  entry_len = snprintf(entry, sizeof(entry), "{\"ts\":%llu,\"values\":{\"%s%s\":%s}}",
+                       (unsigned long long)epoch_ms(), resources[p->resource].key,
+                       nodes[p->node].suffix, value);
+  pthread_mutex_lock(&batch_lock);
+  if(batch.samples == 0) {
+    batch.len = 0;
+    batch_append(&batch, "[", 1);
+    batch.started = now_ms();
+  } else {
+    batch_append(&batch, ",", 1);
+  }
+  batch_append(&batch, entry, entry_len);
+  batch.samples++;
+  if(batch.samples == 1 || batch.samples == max_batch) {
+    pthread_cond_signal(&batch_cond); /* arm the flush timer, or flush now */
+  }
+  pthread_mutex_unlock(&batch_lock);
+  stat_samples++;
+}
+/*---------------------------------------------------------------------------*/
+static int
+post_batch(struct batch *b)
+{
+  b->data[b->len] = ']';
+  return http_post(b->data, b->len + 1);
+}
+/*---------------------------------------------------------------------------*/
+/* Uploads the batch every FLUSH_MS or MAX_BATCH samples; a failed upload is put
+ * back in front of the samples taken meanwhile (up to MAX_PENDING) and retried
+ * with exponential backoff. Once stopping, makes a last attempt and returns. */
+static void *
+upload_thread(void *arg)
+{
+  static struct batch sending;
+  struct batch swap;
+  uint64_t now, due, retry_at = 0;
+  uint32_t retry_ms = 0;
+  int failed;
+
+  (void)arg;
+  pthread_mutex_lock(&batch_lock);
+  while(!stopping) {
+    if(batch.samples == 0) {
+      pthread_cond_wait(&batch_cond, &batch_lock);
+      continue;
+    }
+    now = now_ms();
+    due = batch.samples >= max_batch ? now : batch.started + FLUSH_MS;
+    if(due < retry_at) {
+      due = retry_at;
+    }
+    if(now < due) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_MONOTONIC, &deadline);
+      deadline.tv_sec += (due - now) / 1000;
+      deadline.tv_nsec += (due - now) % 1000 * 1000000;
+      if(deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+      }
+      pthread_cond_timedwait(&batch_cond, &batch_lock, &deadline);
+      continue;
+    }
+
+    swap = sending;
+    sending = batch;
+    batch = swap;
+    batch.samples = 0;
+    pthread_mutex_unlock(&batch_lock);
+    failed = post_batch(&sending) < 0;
+    pthread_mutex_lock(&batch_lock);
+
+    if(failed) {
+      if(batch.samples > 0) {
+        batch_append(&sending, ",", 1);
+        batch_append(&sending, batch.data + 1, batch.len - 1);
+        sending.samples += batch.samples;
+      }
+      swap = batch;
+      batch = sending;
+      sending = swap;
+      if(batch.samples > MAX_PENDING) {
+        fprintf(stderr, "[poller] backend unreachable, dropping the %d oldest samples\n",
+                batch.samples - MAX_PENDING);
+        batch_drop_oldest(&batch, batch.samples - MAX_PENDING);
+      }
+      retry_ms = retry_ms == 0 ? MIN_RETRY_MS : (retry_ms * 2 > MAX_RETRY_MS ? MAX_RETRY_MS : retry_ms * 2);
+      retry_at = now_ms() + retry_ms;
+      fprintf(stderr, "[poller] upload failed, retrying in %u ms\n", retry_ms);
+    } else {
+      stat_uploads++;
+      retry_ms = 0;
+      retry_at = 0;
+    }
+  }
+  pthread_mutex_unlock(&batch_lock);
+
+  if(batch.samples > 0 && post_batch(&batch) == 0) {
+    stat_uploads++;
+  }
+  http_close();
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+int
+main(void)
+{
+  uint64_t now;
+  struct sockaddr_in6 local;
+  pthread_t uploader;
+  pthread_condattr_t cond_attr;
+  sigset_t signals;
+  int i, j;
+
+  if(parse_nodes(env_or("SENSOR_SERVER", "")) < 0
+     || parse_resources(env_or("SENSOR_PATHS", "s/l=light,s/t=temperature,s/r=rain")) < 0
+     || parse_url(env_or("THINGSBOARD_URL", "http://mauro.rezel.net:8080"), env_or("DEVICE_TOKEN", "MONITOKEN")) < 0) {
+    fprintf(stderr, "usage: SENSOR_SERVER=<IPv6>[,<IPv6>...] [DEVICE_TOKEN=...] [THINGSBOARD_URL=http://host:port] poller\n");
+    return 1;
+  }
+  period_ms = strtoull(env_or("POLL_PERIOD_MS", "1000"), NULL, 10);
+  nstart = atoi(env_or("NSTART", "1"));
+  max_batch = atoi(env_or("MAX_BATCH", "500"));
+  if(nstart < 1 || max_batch < 1) {
+    fprintf(stderr, "[poller] NSTART and MAX_BATCH must be positive\n");
+    return 1;
+  }
+
+  udp_fd = socket(AF_INET6, SOCK_DGRAM, 0);
+  memset(&local, 0, sizeof(local));
+  local.sin6_family = AF_INET6;
+  if(udp_fd < 0 || bind(udp_fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+    perror("[poller] socket");
+    return 1;
+  }
+
+  srand((unsigned)epoch_ms());
+  next_mid = rand();
+  now = now_ms();
+  poll_count = node_count * resource_count;
+  polls = calloc(poll_count, sizeof(*polls));
+  for(i = 0; i < node_count; i++) {
+    for(j = 0; j < resource_count; j++) {
+      struct poll_state *p = &polls[i * resource_count + j];
+      p->node = i;
+      p->resource = j;
+      /* random phase, so the nodes are not polled in lock-step */
+      p->next_ms = now + (period_ms > 0 ? (uint64_t)rand() % period_ms : 0);
+    }
+  }
+
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  signal(SIGPIPE, SIG_IGN);
+
+  /* the upload thread waits on CLOCK_MONOTONIC like the loop, and leaves Ctrl-C to it */
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&batch_cond, &cond_attr);
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  if(pthread_create(&uploader, NULL, upload_thread, NULL) != 0) {
+    fprintf(stderr, "[poller] cannot start the upload thread\n");
+    return 1;
+  }
+  pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+  fprintf(stderr, "[poller] %d node(s) x %d sensor(s) every %llu ms -> http://%s:%s%s\n",
+          node_count, resource_count, (unsigned long long)period_ms, http_host, http_port, http_path);
+
+  while(running) {
+    struct pollfd pfd = { udp_fd, POLLIN, 0 };
+    uint64_t wake;
+
+    now = now_ms();
+    wake = now + 100;
+    for(i = 0; i < poll_count; i++) {
+      struct poll_state *p = &polls[i];
+      if(p->state == POLL_IDLE) {
+        if(p->next_ms > now && p->next_ms < wake) {
+          wake = p->next_ms;
+        }
+      } else if(p->timeout_at <= now) {
+        if(p->retransmits == COAP_MAX_RETRANSMIT) {
+          stat_timeouts++;
+          finish_request(p, now);
+          continue;
+        }
+        p->retransmits++;
+        p->timeout_ms *= 2;
+        p->timeout_at = now + p->timeout_ms;
+        coap_send(p);
+      }
+      if(p->state == POLL_IN_FLIGHT && p->timeout_at < wake) {
+        wake = p->timeout_at;
+      }
+    }
+    for(i = 0; i < node_count; i++) {
+      struct poll_state *p;
+      while(nodes[i].in_flight < nstart && (p = next_due(i, now)) != NULL) {
+        start_request(p, now);
+        if(p->timeout_at < wake) {
+          wake = p->timeout_at;
+        }
+      }
+    }
+
+    if(poll(&pfd, 1, wake > now ? (int)(wake - now) : 0) > 0) {
+      coap_receive(now_ms());
+    }
+  }
+
+  pthread_mutex_lock(&batch_lock);
+  stopping = 1;
+  pthread_cond_signal(&batch_cond);
+  pthread_mutex_unlock(&batch_lock);
+  pthread_join(uploader, NULL);
+  fprintf(stderr, "[poller] samples %lu, uploads %lu, timeouts %lu, errors %lu, dropped %lu\n",
+          stat_samples, stat_uploads, stat_timeouts, stat_errors, stat_dropped);
+  return 0;
+}
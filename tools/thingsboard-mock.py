@@ -0,0 +1,364 @@
+#!/usr/bin/env python3
+"""
+Local stand-in for ThingsBoard's telemetry ingestion, for offline load tests.
+
+Accepts telemetry like ThingsBoard does:
+  HTTP  POST /api/v1/<token>/telemetry                 (--http-port)
+  CoAP  POST coap://host/api/v1/<token>/telemetry      (--coap-port)
+  MQTT  PUBLISH v1/devices/me/telemetry, token as user (--mqtt-port)
+and records every sample (one key/value) with its arrival time as a JSON line:
+  {"arrival": ms, "transport": "http", "device": token, "ts": ms or null, "key": k, "value": v}
+
+With --node-port it also plays a resource server on [::1]: GETs on the sensor
+paths (s/t, s/l, s/r, ...) return a counter that increases with every response,
+recorded as {"transport": "node", ...}, so a benchmark can tell which sampled
+values never arrived; asked for JSON (Accept: 50) they come timestamped like
+resources/sample-format.h. Only the standard library is needed.
+"""
+import argparse
+import asyncio
+import json
+import re
+import sys
+import time
+
+
+# Sensor paths of the fake node and their telemetry keys (see client.py)
+NODE_SENSORS = {"s/t": "temperature", "s/l": "light", "s/r": "rain"}
+NODE_ALARMS = ["a/ac", "a/l", "a/f", "a/tr"]
+NODE_LINKS = {"s/t": "my_res/sim_temperature", "s/l": "my_res/sim_light", "s/r": "my_res/sim_rain",
+              "a/ac": "my_res/alarm_accel", "a/l": "my_res/alarm_lights",
+              "a/f": "my_res/alarm_freezing", "a/tr": "my_res/alarm_traffic"}
+
+TELEMETRY_PATH_RE = re.compile(r"^/?api/v1/([^/]+)/telemetry$")
+# ThingsBoard parses leniently, post-sensor-data.sh relies on unquoted keys
+UNQUOTED_KEY_RE = re.compile(r'([{,]\s*)([A-Za-z_][\w-]*)\s*:')
+
+
+def now_ms():
+    return int(time.time() * 1000)
+
+
+class Recorder:
+    def __init__(self, path):
+        self.file = open(path, "a", buffering=1 << 16) if path else None
+        self.counts = {}
+
+    def write(self, transport, device, ts, key, value):
+        self.counts[transport] = self.counts.get(transport, 0) + 1
+        if self.file is not None:
+            self.file.write(json.dumps({"arrival": now_ms(), "transport": transport, "device": device,
+                                        "ts": ts, "key": key, "value": value}) + "\n")
+
+    def telemetry(self, transport, device, body):
+        """Records a ThingsBoard telemetry payload, returns False if it does not parse."""
+        text = body.decode(errors="replace")
+        try:
+            payload = json.loads(text)
+        except ValueError:
+            try:
+                payload = json.loads(UNQUOTED_KEY_RE.sub(r'\1"\2":', text))
+            except ValueError:
+                return False
+
+        for entry in payload if isinstance(payload, list) else [payload]:
+            if not isinstance(entry, dict):
+                return False
+            if "values" in entry:
+                ts, values = int(entry["ts"]), entry["values"]
+            else:
+                ts, values = None, entry
+            for key, value in values.items():
+                self.write(transport, device, ts, key, value)
+        return True
+
+    def flush(self):
+        if self.file is not None:
+            self.file.flush()
+
+
+# HTTP ========================================================================
+
+
+async def handle_http(recorder, reader, writer):
+    try:
+        while True:
+            request_line = (await reader.readline()).decode(errors="replace").split()
+            if len(request_line) < 3:
+                break
+            method, path, version = request_line[:3]
+            headers = {}
+            while True:
+                line = (await reader.readline()).decode(errors="replace").strip()
+                if not line:
+                    break
+                name, _, value = line.partition(":")
+                headers[name.strip().lower()] = value.strip()
+            body = await reader.readexactly(int(headers.get("content-length", 0)))
+
+            match = TELEMETRY_PATH_RE.match(path)
+            if method != "POST" or match is None:
+                status = "404 Not Found"
+            elif recorder.telemetry("http", match.group(1), body):
+                status = "200 OK"
+            else:
+                status = "400 Bad Request"
+
+            close = version == "HTTP/1.0" or headers.get("connection", "").lower() == "close"
+            writer.write(f"HTTP/1.1 {status}\r\nContent-Length: 0\r\n"
+                         f"Connection: {'close' if close else 'keep-alive'}\r\n\r\n".encode())
+            await writer.drain()
+            if close:
+                break
+    except (ConnectionError, asyncio.IncompleteReadError, ValueError):
+        pass
+    finally:
+        writer.close()
+
+
+# CoAP ========================================================================
+
+
+COAP_CON, COAP_NON, COAP_ACK = 0, 1, 2
+COAP_GET, COAP_POST, COAP_PUT = 1, 2, 3
+COAP_CONTENT, COAP_CHANGED, COAP_BAD_REQUEST, COAP_NOT_FOUND = 0x45, 0x44, 0x80, 0x84
+OPTION_URI_PATH, OPTION_CONTENT_FORMAT, OPTION_MAX_AGE, OPTION_ACCEPT = 11, 12, 14, 17
+FORMAT_JSON = 50
+
+
+def parse_coap(data):
+    """:return: (type, code, message id, token, {option number: [values]}, payload)"""
+    mtype, tkl = (data[0] >> 4) & 3, data[0] & 0x0F
+    code, mid = data[1], int.from_bytes(data[2:4], "big")
+    token = data[4:4 + tkl]
+    options = {}
+    i, number = 4 + tkl, 0
+    while i < len(data) and data[i] != 0xFF:
+        delta, length = data[i] >> 4, data[i] & 0x0F
+        i += 1
+        if delta == 13:
+            delta, i = data[i] + 13, i + 1
+        elif delta == 14:
+            delta, i = int.from_bytes(data[i:i + 2], "big") + 269, i + 2
+        if length == 13:
+            length, i = data[i] + 13, i + 1
+        elif length == 14:
+            length, i = int.from_bytes(data[i:i + 2], "big") + 269, i + 2
+        number += delta
+        options.setdefault(number, []).append(data[i:i + length])
+        i += length
+    return mtype, code, mid, token, options, data[i + 1:]
+
+
+def _option_nibble(value):
+    if value < 13:
+        return value, b""
+    if value < 269:
+        return 13, bytes([value - 13])
+    return 14, (value - 269).to_bytes(2, "big")
+
+
+def build_coap(mtype, code, mid, token, options=(), payload=b""):
+    """options: (number, bytes) pairs in ascending order"""
+    data = bytearray([0x40 | (mtype << 4) | len(token), code]) + mid.to_bytes(2, "big") + token
+    last = 0
+    for number, value in options:
+        delta, delta_ext = _option_nibble(number - last)
+        length, length_ext = _option_nibble(len(value))
+        data += bytes([(delta << 4) | length]) + delta_ext + length_ext + value
+        last = number
+    if payload:
+        data += b"\xff" + payload
+    return bytes(data)
+
+
+class CoapServer(asyncio.DatagramProtocol):
+    """Answers CON requests with a piggybacked ACK and NON requests with a NON response."""
+
+    def __init__(self, handler):
+        self.handler = handler
+        self.transport = None
+        self.next_mid = 1
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data, addr):
+        try:
+            mtype, code, mid, token, options, payload = parse_coap(data)
+        except IndexError:
+            return
+        if mtype not in (COAP_CON, COAP_NON) or code == 0:
+            return
+        path = "/".join(value.decode(errors="replace") for value in options.get(OPTION_URI_PATH, []))
+        response_code, response_options, response_payload = self.handler(code, path, payload, options)
+        if mtype == COAP_CON:
+            reply = build_coap(COAP_ACK, response_code, mid, token, response_options, response_payload)
+        else:
+            self.next_mid = (self.next_mid + 1) & 0xFFFF
+            reply = build_coap(COAP_NON, response_code, self.next_mid, token, response_options, response_payload)
+        self.transport.sendto(reply, addr)
+
+
+def thingsboard_coap_handler(recorder):
+    def handler(code, path, payload, options):
+        match = TELEMETRY_PATH_RE.match(path)
+        if code != COAP_POST or match is None:
+            return COAP_NOT_FOUND, (), b""
+        if not recorder.telemetry("coap", match.group(1), payload):
+            return COAP_BAD_REQUEST, (), b""
+        return COAP_CHANGED, (), b""
+
+    return handler
+
+
+def node_coap_handler(recorder):
+    counters = {path: 0 for path in NODE_SENSORS}
+
+    def handler(code, path, payload, options):
+        if code == COAP_PUT and path == "tm":
+            # time sync (timesync.py): the mock's clock is the gateway's, no error, no drift
+            return COAP_CHANGED, (), b"0 0"
+        if code != COAP_GET:
+            return COAP_NOT_FOUND, (), b""
+        if path == ".well-known/core":
+            links = ",".join(f"</{link}>" for link in NODE_LINKS.values())
+            return COAP_CONTENT, [(OPTION_CONTENT_FORMAT, bytes([40]))], links.encode()
+        if path in NODE_ALARMS:
+            return COAP_CONTENT, [(OPTION_MAX_AGE, bytes([60]))], b"0"
+        if path in NODE_SENSORS:
+            counters[path] += 1
+            recorder.write("node", None, None, NODE_SENSORS[path], counters[path])
+            if bytes([FORMAT_JSON]) in options.get(OPTION_ACCEPT, []):
+                # the timestamped form of resources/sample-format.h
+                sample = {"v": counters[path], "n": counters[path] & 0xFFFF, "t": now_ms()}
+                return (COAP_CONTENT, [(OPTION_CONTENT_FORMAT, bytes([FORMAT_JSON])), (OPTION_MAX_AGE, bytes([1]))],
+                        json.dumps(sample, separators=(",", ":")).encode())
+            return COAP_CONTENT, [(OPTION_MAX_AGE, bytes([1]))], str(counters[path]).encode()
+        return COAP_NOT_FOUND, (), b""
+
+    return handler
+
+
+# MQTT ========================================================================
+
+
+MQTT_CONNECT, MQTT_PUBLISH, MQTT_PUBREL, MQTT_SUBSCRIBE = 1, 3, 6, 8
+MQTT_PINGREQ, MQTT_DISCONNECT = 12, 14
+MQTT_TELEMETRY_TOPIC = "v1/devices/me/telemetry"
+
+
+async def read_mqtt_packet(reader):
+    first = (await reader.readexactly(1))[0]
+    length, shift = 0, 0
+    while True:
+        byte = (await reader.readexactly(1))[0]
+        length |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            break
+    return first >> 4, first & 0x0F, await reader.readexactly(length)
+
+
+def _mqtt_string(data, i):
+    length = int.from_bytes(data[i:i + 2], "big")
+    return data[i + 2:i + 2 + length].decode(errors="replace"), i + 2 + length
+
+
+async def handle_mqtt(recorder, reader, writer):
+    """Just enough of MQTT 3.1.1 for telemetry publishers: nothing is forwarded to subscribers."""
+    device = None
+    try:
+        while True:
+            packet_type, flags, body = await read_mqtt_packet(reader)
+            if packet_type == MQTT_CONNECT:
+                _, i = _mqtt_string(body, 0)
+                connect_flags = body[i + 1]
+                _, i = _mqtt_string(body, i + 4)  # client id
+                if connect_flags & 0x04:  # will topic and message
+                    _, i = _mqtt_string(body, i)
+                    _, i = _mqtt_string(body, i)
+                if connect_flags & 0x80:
+                    device, i = _mqtt_string(body, i)
+                writer.write(bytes([0x20, 2, 0, 0]))
+            elif packet_type == MQTT_PUBLISH:
+                qos = (flags >> 1) & 3
+                topic, i = _mqtt_string(body, 0)
+                packet_id = body[i:i + 2] if qos else b""
+                payload = body[i + len(packet_id):]
+                if topic == MQTT_TELEMETRY_TOPIC:
+                    recorder.telemetry("mqtt", device, payload)
+                if qos == 1:
+                    writer.write(bytes([0x40, 2]) + packet_id)
+                elif qos == 2:
+                    writer.write(bytes([0x50, 2]) + packet_id)
+            elif packet_type == MQTT_PUBREL:
+                writer.write(bytes([0x70, 2]) + body[:2])
+            elif packet_type == MQTT_SUBSCRIBE:
+                topics = 0
+                i = 2
+                while i < len(body):
+                    _, i = _mqtt_string(body, i)
+                    i += 1
+                    topics += 1
+                writer.write(bytes([0x90, 2 + topics]) + body[:2] + bytes(topics))
+            elif packet_type == MQTT_PINGREQ:
+                writer.write(bytes([0xD0, 0]))
+            elif packet_type == MQTT_DISCONNECT:
+                break
+            await writer.drain()
+    except (ConnectionError, asyncio.IncompleteReadError, IndexError):
+        pass
+    finally:
+        writer.close()
+
+
+# MAIN ========================================================================
+
+
+async def report(recorder, period):
+    while True:
+        await asyncio.sleep(period)
+        recorder.flush()
+        print(f"[thingsboard-mock] samples received: {recorder.counts}", file=sys.stderr)
+
+
+async def main(args):
+    recorder = Recorder(args.record)
+    loop = asyncio.get_running_loop()
+    servers = []
+    if args.http_port:
+        servers.append(await asyncio.start_server(
+            lambda r, w: handle_http(recorder, r, w), args.host, args.http_port))
+    if args.mqtt_port:
+        servers.append(await asyncio.start_server(
+            lambda r, w: handle_mqtt(recorder, r, w), args.host, args.mqtt_port))
+    if args.coap_port:
+        await loop.create_datagram_endpoint(lambda: CoapServer(thingsboard_coap_handler(recorder)),
+                                            local_addr=(args.host, args.coap_port))
+    if args.node_port:
+        await loop.create_datagram_endpoint(lambda: CoapServer(node_coap_handler(recorder)),
+                                            local_addr=("::1", args.node_port))
+    print(f"[thingsboard-mock] http:{args.http_port} coap:{args.coap_port} mqtt:{args.mqtt_port} "
+          f"node:[::1]:{args.node_port}", file=sys.stderr)
+    try:
+        await report(recorder, args.report_period)
+    finally:
+        recorder.flush()
+        for server in servers:
+            server.close()
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--http-port", type=int, default=8080, help="0 disables HTTP")
+    parser.add_argument("--coap-port", type=int, default=5685, help="0 disables CoAP")
+    parser.add_argument("--mqtt-port", type=int, default=1883, help="0 disables MQTT")
+    parser.add_argument("--node-port", type=int, default=0, help="fake resource server on [::1], 0 disables it")
+    parser.add_argument("--record", help="append arrivals to this JSON lines file")
+    parser.add_argument("--report-period", type=float, default=10, help="seconds between counts on stderr")
+    try:
+        asyncio.run(main(parser.parse_args()))
+    except KeyboardInterrupt:
+        pass
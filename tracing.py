@@ -0,0 +1,112 @@
+"""
+End-to-end tracing of samples, from the node to ThingsBoard.
+
+Asked for JSON, nodes answer with {"v": value, "n": sequence, "t": ms since the
+epoch} ("u": ms since boot while their time is not set), see
+resources/sample-format.h. Every hop then adds its timestamp to the sample's trace:
+  node      when the node took the sample ("t")
+  gateway   when client.py received the response or notification
+  uploaded  when ThingsBoard acknowledged the batch holding it
+and the latency of each hop goes to Prometheus. The border router forwards the
+packets untouched, so its share is inside node_to_gateway; gateway_coap_rtt_seconds
+tells the radio round trip apart.
+Sequence numbers per node and resource reveal samples the node took but the
+gateway never received (gaps), e.g. responses lost after the node answered.
+"""
+import json
+import time
+
+import metrics
+
+
+# A node clock further off than this (seconds) is not set or not synchronized yet:
+# its samples are stamped with the gateway's time and left out of the hop latencies
+MAX_CLOCK_SKEW = 300
+# Sequence numbers are 16 bits, a drop from above the high mark to below the low one is a wrap
+SEQUENCE_HIGH, SEQUENCE_LOW = 65536 - 1024, 1024
+
+HOP_LATENCY = metrics.histogram("gateway_hop_latency_seconds",
+                                "Latency of one hop of a sample: node_to_gateway, gateway_to_thingsboard, end_to_end",
+                                ("hop",))
+SAMPLE_GAPS = metrics.counter("gateway_sample_gaps_total",
+                              "Samples missing from a node's sequence numbers", ("node", "resource"))
+SEQUENCE_RESETS = metrics.counter("gateway_sequence_resets_total",
+                                  "Sequence numbers that went backwards, i.e. node restarts", ("node", "resource"))
+
+
+def now_ms():
+    return int(time.time() * 1000)
+
+
+class Sample:
+    def __init__(self, value, seq=None, node_ms=None, received_ms=None):
+        self.value = value
+        self.seq = seq
+        self.node_ms = node_ms
+        self.received_ms = received_ms if received_ms is not None else now_ms()
+
+    def clock_trusted(self):
+        return self.node_ms is not None and abs(self.received_ms - self.node_ms) <= MAX_CLOCK_SKEW * 1000
+
+    def ts(self):
+        """Timestamp to upload: the node's when its clock is plausible, else the arrival time."""
+        return self.node_ms if self.clock_trusted() else self.received_ms
+
+    def trace(self):
+        """Hop timestamps (ms) stored with the spooled record."""
+        return {"node": self.node_ms if self.clock_trusted() else None, "gateway": self.received_ms}
+
+
+def parse_sample(payload, received_ms=None):
+    """Parses a bare value ("21", "1.4") or the timestamped JSON form."""
+    text = payload.decode(errors="replace") if isinstance(payload, bytes) else payload
+    if text.lstrip().startswith("{"):
+        data = json.loads(text)
+        return Sample(data["v"], data.get("n"), data.get("t"), received_ms)
+    return Sample(float(text), received_ms=received_ms)
+
+
+class SequenceTracker:
+    """Last sequence number per (node, resource)."""
+
+    def __init__(self):
+        self.last = {}
+
+    def check(self, node, resource, sample):
+        """
+        Counts gaps and restarts and observes the node_to_gateway hop.
+        :return: False if the sample was seen before (e.g. a cached response)
+        """
+        if sample.seq is None:
+            return True
+        key = (node, resource)
+        last = self.last.get(key)
+        self.last[key] = sample.seq
+        if last is not None:
+            if sample.seq == last:
+                return False
+            if sample.seq < last and not (last >= SEQUENCE_HIGH and sample.seq < SEQUENCE_LOW):
+                SEQUENCE_RESETS.inc(node, resource)
+            else:
+                missing = (sample.seq - last) % 65536 - 1
+                if missing:
+                    SAMPLE_GAPS.inc(node, resource, amount=missing)
+        if sample.clock_trusted():
+            HOP_LATENCY.observe((sample.received_ms - sample.node_ms) / 1000, "node_to_gateway")
+        return True
+
+    def forget(self, node):
+        for key in [key for key in self.last if key[0] == node]:
+            del self.last[key]
+
+
+def observe_uploaded(records, acked_ms=None):
+    """Observes the upload hops of records ThingsBoard just acknowledged."""
+    acked_ms = acked_ms if acked_ms is not None else now_ms()
+    for record in records:
+        trace = record.get("trace")
+        if trace is None:
+            continue
+        HOP_LATENCY.observe((acked_ms - trace["gateway"]) / 1000, "gateway_to_thingsboard")
+        if trace.get("node") is not None:
+            HOP_LATENCY.observe((acked_ms - trace["node"]) / 1000, "end_to_end")